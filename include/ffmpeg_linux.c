@@ -6,6 +6,8 @@
 #include <string.h>
 #include <errno.h>
 
+#include <fcntl.h>
+#include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -31,6 +33,9 @@ FFMPEG *ffmpeg_start_rendering_video(const char *output_path, size_t width, size
         return NULL;
     }
 
+    // other ffmpeg children must not keep this pipe open, it would never end
+    fcntl(pipefd[WRITE_END], F_SETFD, FD_CLOEXEC);
+
     pid_t child = fork();
     if (child < 0) {
         TraceLog(LOG_ERROR, "FFMPEG: could not fork a child: %s", strerror(errno));
@@ -88,15 +93,26 @@ FFMPEG *ffmpeg_start_rendering_video(const char *output_path, size_t width, size
     return ffmpeg;
 }
 
-FFMPEG *ffmpeg_start_rendering_audio(const char *output_path)
+// Codec follows the extension of the output, FLAC or 32-bit float WAV.
+FFMPEG *ffmpeg_start_rendering_audio(const char *output_path, size_t channels, size_t sample_rate)
 {
     int pipefd[2];
 
+    const char *extension = strrchr(output_path, '.');
+    const char *codec = extension != NULL && strcmp(extension, ".flac") == 0 ? "flac" : "pcm_f32le";
+    char channels_arg[32];
+    snprintf(channels_arg, sizeof(channels_arg), "%zu", channels);
+    char sample_rate_arg[32];
+    snprintf(sample_rate_arg, sizeof(sample_rate_arg), "%zu", sample_rate);
+
     if (pipe(pipefd) < 0) {
         TraceLog(LOG_ERROR, "FFMPEG: Could not create a pipe: %s", strerror(errno));
         return NULL;
     }
 
+    // other ffmpeg children must not keep this pipe open, it would never end
+    fcntl(pipefd[WRITE_END], F_SETFD, FD_CLOEXEC);
+
     pid_t child = fork();
     if (child < 0) {
         TraceLog(LOG_ERROR, "FFMPEG: could not fork a child: %s", strerror(errno));
@@ -117,11 +133,11 @@ FFMPEG *ffmpeg_start_rendering_audio(const char *output_path)
             "-y",
 
             "-f", "f32le",
-            "-ar", "44100",
-            "-ac", "2",
+            "-ar", sample_rate_arg,
+            "-ac", channels_arg,
             "-i", "-",
 
-            "-c:a", "pcm_f32le",
+            "-c:a", codec,
             output_path,
 
             NULL
@@ -204,3 +220,11 @@ bool ffmpeg_send_sound_samples(FFMPEG *ffmpeg, void *data, size_t size)
     }
     return true;
 }
+
+// Bytes written into the pipe that ffmpeg has not read yet, -1 on error.
+long ffmpeg_queued_bytes(FFMPEG *ffmpeg)
+{
+    int queued = 0;
+    if (ioctl(ffmpeg->pipe, FIONREAD, &queued) < 0) return -1;
+    return queued;
+}
@@ -0,0 +1,105 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "simd.h"
+
+// Automation turns per step setting values into per sample values. A ramp
+// goes from the value of the current step to the value of the next step over
+// the step duration. Values are produced for a whole block at once, so the
+// oscillators read plain arrays whether a parameter is stepped or ramped.
+
+#define ENGINE_BLOCK_SIZE 256 // frames, multiple of 4
+
+typedef struct {
+    float wave1[ENGINE_BLOCK_SIZE];
+    float wave2[ENGINE_BLOCK_SIZE];
+    float wave3[ENGINE_BLOCK_SIZE];
+    float cutoff; // filters take one value per block, at its end
+} SettingBlock;
+
+// t is position inside of the step of the first frame, 0..1, dt is step per frame.
+// Writes count rounded up to 4 values.
+void automation_fill(float *out, size_t count, float from, float to, Ramp ramp, float t, float dt) {
+    f32x4 position = f32x4_splat(t) + F32X4_IOTA * dt;
+    f32x4 advance = f32x4_splat(4 * dt);
+    f32x4 start = f32x4_splat(from);
+    f32x4 distance = f32x4_splat(to - from);
+
+    if (ramp == RAMP_EXPONENTIAL && (from <= 0 || to <= 0)) ramp = RAMP_LINEAR;
+
+    switch (ramp) {
+    case RAMP_NONE:
+        for (size_t i = 0; i < count; i += 4) f32x4_store(out + i, start);
+        break;
+
+    case RAMP_LINEAR:
+        for (size_t i = 0; i < count; i += 4) {
+            f32x4_store(out + i, start + distance * position);
+            position += advance;
+        }
+        break;
+
+    case RAMP_EXPONENTIAL: {
+        // from * (to/from)^t, advanced by a constant factor per vector
+        float ratio = to / from;
+        f32x4 value = start;
+        for (int lane = 0; lane < 4; lane++) value[lane] = from * powf(ratio, position[lane]);
+        f32x4 factor = f32x4_splat(powf(ratio, 4 * dt));
+        for (size_t i = 0; i < count; i += 4) {
+            f32x4_store(out + i, value);
+            value *= factor;
+        }
+    } break;
+
+    case RAMP_CURVE:
+        // smoothstep, eases in and out of both values
+        for (size_t i = 0; i < count; i += 4) {
+            f32x4 curve = position * position * (f32x4_splat(3.0f) - 2.0f * position);
+            f32x4_store(out + i, start + distance * curve);
+            position += advance;
+        }
+        break;
+    }
+}
+
+// Value of the ramp at t, 0..1 inside of the step.
+float automation_value(float from, float to, Ramp ramp, float t) {
+    if (ramp == RAMP_EXPONENTIAL && (from <= 0 || to <= 0)) ramp = RAMP_LINEAR;
+    switch (ramp) {
+    case RAMP_NONE:        return from;
+    case RAMP_LINEAR:      return from + (to - from) * t;
+    case RAMP_EXPONENTIAL: return from * powf(to / from, t);
+    case RAMP_CURVE:       return from + (to - from) * t * t * (3.0f - 2.0f * t);
+    }
+    return from;
+}
+
+// Sum of the values of the first frames of a step of step_frames, in closed
+// form, what the per sample values add up to without rounding.
+double automation_sum(float from, float to, Ramp ramp, uint64_t step_frames, uint64_t frames) {
+    if (ramp == RAMP_EXPONENTIAL && (from <= 0 || to <= 0)) ramp = RAMP_LINEAR;
+    double n = (double)frames, length = (double)step_frames, distance = (double)to - from;
+    double t1 = n * (n - 1) / 2;             // sum of k for k < n
+    double t2 = t1 * (2 * n - 1) / 3;        // k^2
+    double t3 = t1 * t1;                     // k^3
+    switch (ramp) {
+    case RAMP_NONE:   return from * n;
+    case RAMP_LINEAR: return from * n + distance * t1 / length;
+    case RAMP_EXPONENTIAL: {
+        double growth = log((double)to / from) / length; // per frame, a geometric series
+        if (growth == 0) return from * n;
+        return from * expm1(growth * n) / expm1(growth);
+    }
+    case RAMP_CURVE:
+        return from * n + distance * (3 * t2 / (length * length) - 2 * t3 / (length * length * length));
+    }
+    return from * n;
+}
+
+void automation_fill_setting(SettingBlock *block, const Setting *from, const Setting *to, size_t count, float t, float dt) {
+    automation_fill(block->wave1, count, from->wave1, to->wave1, from->ramp1, t, dt);
+    automation_fill(block->wave2, count, from->wave2, to->wave2, from->ramp2, t, dt);
+    automation_fill(block->wave3, count, from->wave3, to->wave3, from->ramp3, t, dt);
+    block->cutoff = automation_value(from->cutoff, to->cutoff, from->cutoff_ramp, t + count * dt);
+}
@@ -0,0 +1,89 @@
+#include <stdbool.h>
+
+#include "raylib.h"
+#include "rlgl.h"
+
+// Render batch owned by the app instead of rlgl's default one, so its size
+// and the number of buffers it rotates through can be set. With several
+// buffers a flush uploads into a buffer the GPU was done with a few flushes
+// ago instead of the one it may still be drawing from.
+//
+// rlgl does not report its flushes, so the app flushes the batch itself
+// through render_batch_flush before anything that would flush it, and
+// reserves room before long runs of shapes. The flushes raylib does on
+// state changes then find the batch empty and cost nothing. Flushes that
+// happen behind our back are not counted.
+
+#define RENDER_BATCH_BUFFERS 3
+#define RENDER_BATCH_ELEMENTS 16384 // quads per buffer, rlgl's default is 8192
+
+typedef struct {
+    int flushes;
+    int draw_calls;
+    int vertices;
+} BatchStats;
+
+typedef struct {
+    rlRenderBatch batch;
+    BatchStats frame;      // counted in the current frame
+    BatchStats last_frame;
+} RenderBatch;
+
+void render_batch_load(RenderBatch *render_batch, int buffers, int elements) {
+    *render_batch = (RenderBatch) {0};
+    render_batch->batch = rlLoadRenderBatch(buffers, elements);
+    rlSetRenderBatchActive(&render_batch->batch);
+}
+
+void render_batch_unload(RenderBatch *render_batch) {
+    if (render_batch->batch.vertexBuffer == NULL) return;
+    rlSetRenderBatchActive(NULL);
+    rlUnloadRenderBatch(render_batch->batch);
+    *render_batch = (RenderBatch) {0};
+}
+
+// Vertices waiting in the batch, including the ones rlgl adds for alignment.
+static int render_batch_pending(const RenderBatch *render_batch, int *draw_calls, int *vertices) {
+    const rlRenderBatch *batch = &render_batch->batch;
+    int calls = 0, count = 0, used = 0;
+    for (int i = 0; i < batch->drawCounter; i++) {
+        if (batch->draws[i].vertexCount > 0) calls++;
+        count += batch->draws[i].vertexCount;
+        used += batch->draws[i].vertexCount + batch->draws[i].vertexAlignment;
+    }
+    if (draw_calls != NULL) *draw_calls = calls;
+    if (vertices != NULL) *vertices = count;
+    return used;
+}
+
+void render_batch_flush(RenderBatch *render_batch) {
+    if (render_batch->batch.vertexBuffer == NULL) return;
+
+    int draw_calls, vertices;
+    render_batch_pending(render_batch, &draw_calls, &vertices);
+    if (vertices > 0) {
+        render_batch->frame.flushes++;
+        render_batch->frame.draw_calls += draw_calls;
+        render_batch->frame.vertices += vertices;
+    }
+    rlDrawRenderBatchActive();
+}
+
+// Flushes now if the batch has no room for that many vertices and draw calls,
+// so rlgl does not have to do it halfway through.
+void render_batch_reserve(RenderBatch *render_batch, int vertices, int draw_calls) {
+    const rlRenderBatch *batch = &render_batch->batch;
+    if (batch->vertexBuffer == NULL) return;
+
+    int capacity = batch->vertexBuffer[batch->currentBuffer].elementCount * 4;
+    int used = render_batch_pending(render_batch, NULL, NULL);
+    if (used + vertices >= capacity || batch->drawCounter + draw_calls >= RL_DEFAULT_BATCH_DRAWCALLS) {
+        render_batch_flush(render_batch);
+    }
+}
+
+// Call once the frame is flushed, before the next one starts drawing.
+void render_batch_end_frame(RenderBatch *render_batch) {
+    render_batch->last_frame = render_batch->frame;
+    render_batch->frame = (BatchStats) {0};
+}
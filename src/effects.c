@@ -0,0 +1,142 @@
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "simd.h"
+
+// Effects on the send bus: a ping-pong delay and a reverb, both fed with the
+// mono sum of the track sends and added back into the stereo mix.
+//
+// The reverb is a feedback delay network of four lines. One ring holds a
+// vector of all four lines per frame, each line reads it at its own delay,
+// so a frame is a single vector through the damping, the Hadamard mix and
+// the write. Rings are power-of-two sized and indexed with a mask, they are
+// part of the state and nothing is allocated on the audio thread.
+//
+// A zeroed Effects passes the mix through untouched.
+
+// Rings hold the longest delay and reverb line at AUDIO_MAX_SAMPLE_RATE, so
+// the effects sound the same at every engine rate.
+#define EFFECTS_DELAY_RING (1 << 16)  // frames, 0.34 s at 192 kHz
+#define EFFECTS_REVERB_RING (1 << 14) // 85 ms at 192 kHz
+#define EFFECTS_REVERB_LINES 4
+#define EFFECTS_SILENCE 1e-4f         // -80 dB
+
+#define EFFECTS_DELAY_MS 330.0f
+#define EFFECTS_DELAY_FEEDBACK 0.35f
+#define EFFECTS_DELAY_WET 0.25f
+#define EFFECTS_REVERB_SECONDS 2.0f   // to fall by 60 dB
+#define EFFECTS_REVERB_DAMPING 0.3f
+#define EFFECTS_REVERB_WET 0.3f
+
+// Mutually prime line lengths in ms, around 30 to 45.
+static const float effects_reverb_ms[EFFECTS_REVERB_LINES] = { 32.5f, 36.3f, 42.3f, 46.6f };
+
+typedef struct {
+    size_t delay_frames;                     // 0 if the effects are off
+    size_t reverb_frames[EFFECTS_REVERB_LINES];
+    f32x4 reverb_feedback;                   // per line, for the decay time
+    size_t longest;                          // frames a sound can stay in a ring
+    _Atomic(bool) is_reset_requested;
+
+    // audio thread
+    float delay[EFFECTS_DELAY_RING][2];
+    f32x4 reverb[EFFECTS_REVERB_RING];
+    f32x4 damping;                           // lowpass state per line
+    size_t cursor;                           // next frame to write, both rings
+    size_t quiet_frames;                     // in and out below EFFECTS_SILENCE
+} Effects;
+
+static void effects_reset(Effects *effects) {
+    memset(effects->delay, 0, sizeof(effects->delay));
+    memset(effects->reverb, 0, sizeof(effects->reverb));
+    effects->damping = f32x4_splat(0);
+    effects->cursor = 0;
+    effects->quiet_frames = effects->longest;
+}
+
+void effects_init(Effects *effects, size_t sample_rate) {
+    effects->delay_frames = (size_t)(EFFECTS_DELAY_MS / 1000 * sample_rate);
+    if (effects->delay_frames >= EFFECTS_DELAY_RING) effects->delay_frames = EFFECTS_DELAY_RING - 1;
+    effects->longest = effects->delay_frames;
+
+    for (size_t k = 0; k < EFFECTS_REVERB_LINES; k++) {
+        size_t frames = (size_t)(effects_reverb_ms[k] / 1000 * sample_rate);
+        if (frames >= EFFECTS_REVERB_RING) frames = EFFECTS_REVERB_RING - 1;
+        effects->reverb_frames[k] = frames;
+        effects->reverb_feedback[k] = powf(10, -3.0f * frames / (EFFECTS_REVERB_SECONDS * sample_rate));
+        if (frames > effects->longest) effects->longest = frames;
+    }
+    effects_reset(effects);
+}
+
+// Any thread, the audio thread clears the rings before the next block.
+void effects_request_reset(Effects *effects) {
+    atomic_store(&effects->is_reset_requested, true);
+}
+
+// Tails have died out, nothing is left in the rings above the threshold.
+bool effects_is_silent(const Effects *effects) {
+    return effects->delay_frames == 0 || effects->quiet_frames >= effects->longest;
+}
+
+// Orthogonal mix of the four lines, scaled so it keeps the energy.
+static inline f32x4 effects_hadamard(f32x4 v) {
+    f32x4 sums = __builtin_shufflevector(v, v, 0, 0, 2, 2)
+               + __builtin_shufflevector(v, v, 1, 1, 3, 3) * (f32x4) { 1, -1, 1, -1 };
+    return (__builtin_shufflevector(sums, sums, 0, 1, 0, 1)
+          + __builtin_shufflevector(sums, sums, 2, 3, 2, 3) * (f32x4) { 1, 1, -1, -1 }) * f32x4_splat(0.5f);
+}
+
+// Adds the effects of count frames of the send bus to the stereo buses.
+void effects_process(Effects *effects, const float *send, float *left, float *right, size_t count) {
+    if (effects->delay_frames == 0) return;
+    if (atomic_exchange(&effects->is_reset_requested, false)) effects_reset(effects);
+
+    float input_peak = 0;
+    for (size_t j = 0; j < count; j++) input_peak = fmaxf(input_peak, fabsf(send[j]));
+    if (input_peak < EFFECTS_SILENCE && effects_is_silent(effects)) return;
+
+    const size_t delay_mask = EFFECTS_DELAY_RING - 1;
+    const size_t reverb_mask = EFFECTS_REVERB_RING - 1;
+    const f32x4 feedback = effects->reverb_feedback;
+    const f32x4 damping = f32x4_splat(EFFECTS_REVERB_DAMPING);
+    f32x4 state = effects->damping;
+    size_t cursor = effects->cursor;
+    float output_peak = 0;
+
+    for (size_t j = 0; j < count; j++, cursor++) {
+        float x = send[j];
+
+        // the delay crosses over, the left echo comes back on the right
+        const float *echo = effects->delay[(cursor - effects->delay_frames) & delay_mask];
+        float *written = effects->delay[cursor & delay_mask];
+        float echo_left = echo[0], echo_right = echo[1];
+        written[0] = x + echo_right * EFFECTS_DELAY_FEEDBACK;
+        written[1] = echo_left * EFFECTS_DELAY_FEEDBACK;
+
+        f32x4 lines = {
+            effects->reverb[(cursor - effects->reverb_frames[0]) & reverb_mask][0],
+            effects->reverb[(cursor - effects->reverb_frames[1]) & reverb_mask][1],
+            effects->reverb[(cursor - effects->reverb_frames[2]) & reverb_mask][2],
+            effects->reverb[(cursor - effects->reverb_frames[3]) & reverb_mask][3],
+        };
+        state = lines + (state - lines) * damping;
+        effects->reverb[cursor & reverb_mask] = effects_hadamard(state * feedback) + f32x4_splat(x * 0.5f);
+
+        float out_left = echo_left * EFFECTS_DELAY_WET + (lines[0] + lines[2]) * EFFECTS_REVERB_WET;
+        float out_right = echo_right * EFFECTS_DELAY_WET + (lines[1] + lines[3]) * EFFECTS_REVERB_WET;
+        left[j] += out_left;
+        right[j] += out_right;
+        output_peak = fmaxf(output_peak, fmaxf(fabsf(out_left), fabsf(out_right)));
+    }
+
+    effects->damping = state;
+    effects->cursor = cursor & (EFFECTS_DELAY_RING - 1);
+    if (input_peak < EFFECTS_SILENCE && output_peak < EFFECTS_SILENCE) {
+        effects->quiet_frames += count;
+    } else {
+        effects->quiet_frames = 0;
+    }
+}
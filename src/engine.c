@@ -0,0 +1,204 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "simd.h"
+
+// Engine renders a song into interleaved frames. All of its state between
+// calls is the phases, filters and voices of the tracks, kept by the caller.
+
+static const Setting silent_setting = {0};
+
+const Setting *track_setting(const Song *song, const Setting *row, size_t track) {
+    if (row == NULL || track >= song->track_count) return &silent_setting;
+    return &row[track];
+}
+
+// Filters and voices carry on, released voices ring out over the loop.
+void reset_phases_on_loop(const Song *song, TrackState *tracks) {
+    for (size_t track = 0; track < song->track_count; track++) {
+        if (!song->tracks[track].reset_on_loop) continue;
+        memset(tracks[track].phases, 0, sizeof(tracks[track].phases));
+        memset(tracks[track].step_phases, 0, sizeof(tracks[track].step_phases));
+    }
+}
+
+// Renders frames of the song starting at first_frame into interleaved output,
+// advancing the phases in tracks. Blocks are also written to the tap if one
+// is given. Separate tracks can render the same song on different threads.
+// If stems is given, every track is also written there with its gain, one
+// after another, frames_count samples each. Without a mixer tracks are mixed
+// as the song says, in the center, and there are no effects.
+void render_song(Song *song, TrackState *tracks, uint64_t first_frame, float *output, size_t frames_count,
+                 StepReader reader, bool wait_for_steps, AudioTap *tap_ring, float *stems, Mixer *mixer) {
+    const TempoMap *tempo = &song->tempo;
+    float sample_rate = (float)tempo->sample_rate;
+    uint64_t frame = first_frame % tempo_song_frames(tempo);
+    size_t position = tempo_find_step(tempo, frame);
+    const uint64_t *next_boundary = &tempo->boundaries[position + 1];
+    const Setting *row = song_row(song, reader, position, wait_for_steps);
+
+    // reset phases to 0 on repeat
+    if (frame == 0) reset_phases_on_loop(song, tracks);
+
+    // render blocks inside of one step at a time, walking the step boundaries
+    float *samples = output;
+    const Setting *next_row = NULL;
+    bool is_next_row_loaded = false;
+    SettingBlock settings;
+    GraphBuffers buffers;
+    float left[ENGINE_BLOCK_SIZE];
+    float right[ENGINE_BLOCK_SIZE];
+    float send[ENGINE_BLOCK_SIZE];
+    float signals[FILTER_LANES][ENGINE_BLOCK_SIZE] = {0};
+    float *const signal_rows[FILTER_LANES] = { signals[0], signals[1], signals[2], signals[3] };
+
+    size_t i = 0;
+    while (i < frames_count) {
+        if (frame == *next_boundary) {
+            position++;
+            next_boundary++;
+
+            if (position == song->settings_count) {
+                position = 0;
+                frame = 0;
+                next_boundary = &tempo->boundaries[1];
+                reset_phases_on_loop(song, tracks);
+            }
+            row = song_row(song, reader, position, wait_for_steps);
+            is_next_row_loaded = false;
+        }
+
+        if (!is_next_row_loaded) {
+            next_row = song_row_peek(song, (position + 1) % song->settings_count);
+            if (next_row == NULL) next_row = row;
+            is_next_row_loaded = true;
+        }
+
+        size_t count = frames_count - i;
+        if (count > *next_boundary - frame) count = *next_boundary - frame;
+        if (count > ENGINE_BLOCK_SIZE) count = ENGINE_BLOCK_SIZE;
+
+        float step_frames = (float)(*next_boundary - next_boundary[-1]);
+        float t = (float)(frame - next_boundary[-1]) / step_frames;
+        memset(left, 0, sizeof(left));
+        memset(right, 0, sizeof(right));
+        memset(send, 0, sizeof(send));
+        TapBlock *tap = tap_ring != NULL ? tap_reserve(tap_ring) : NULL;
+        // tracks go through their filters four at a time
+        for (size_t first = 0; first < song->track_count; first += FILTER_LANES) {
+            size_t lanes = song->track_count - first < FILTER_LANES ? song->track_count - first : FILTER_LANES;
+            const FilterSettings *filters[FILTER_LANES];
+            FilterState *filter_states[FILTER_LANES];
+            float cutoffs[FILTER_LANES];
+
+            for (size_t lane = 0; lane < lanes; lane++) {
+                size_t track = first + lane;
+                const TrackInfo *info = &song->tracks[track];
+                automation_fill_setting(&settings,
+                    track_setting(song, row, track), track_setting(song, next_row, track),
+                    count, t, 1.0f / step_frames);
+
+                if (info->polyphony > 0) {
+                    graph_render_voices(info, song->is_fused[track], &tracks[track], track_setting(song, row, track),
+                        position, &settings, sample_rate, &buffers, signals[lane], count);
+                } else {
+                    const float *signal = graph_render(info, song->is_fused[track], tracks[track].phases, &settings,
+                        sample_rate, &buffers, count);
+                    memcpy(signals[lane], signal, ((count + 3) & ~(size_t)3) * sizeof(float));
+                }
+                filters[lane] = &info->filter;
+                filter_states[lane] = &tracks[track].filter;
+                cutoffs[lane] = settings.cutoff;
+            }
+            filter_process(filters, cutoffs, filter_states, signal_rows, lanes, sample_rate, count);
+
+            for (size_t lane = 0; lane < lanes; lane++) {
+                size_t track = first + lane;
+                const float *signal = signals[lane];
+                if (tap != NULL && track < TAP_MAX_TRACKS) {
+                    memcpy(tap->channels[1 + track], signal, count * sizeof(float));
+                }
+
+                mixer_add_track(mixer, track, song->tracks[track].gain, signal, left, right, send, count);
+                if (stems != NULL) {
+                    float *stem = stems + track * frames_count + i;
+                    for (size_t j = 0; j < count; j++) stem[j] = signal[j] * song->tracks[track].gain;
+                }
+            }
+        }
+        if (mixer != NULL) effects_process(&mixer->effects, send, left, right, count);
+        frame += count;
+
+        // oscillators end the step exactly where the song puts them
+        if (frame == *next_boundary) {
+            uint64_t step_length = *next_boundary - next_boundary[-1];
+            for (size_t track = 0; track < song->track_count; track++) {
+                if (song->tracks[track].polyphony > 0) continue;
+                graph_place_phases(&song->tracks[track], &tracks[track], track_setting(song, row, track),
+                    track_setting(song, next_row, track), step_length, step_length, sample_rate);
+            }
+        }
+
+        if (tap != NULL) {
+            tap->frame = first_frame + i;
+            tap->count = count;
+            tap->track_count = song->track_count < TAP_MAX_TRACKS ? song->track_count : TAP_MAX_TRACKS;
+            float *mix = tap->channels[TAP_CHANNEL_MIX];
+            for (size_t j = 0; j < count; j += 4) {
+                f32x4_store(mix + j, (f32x4_load(left + j) + f32x4_load(right + j)) * f32x4_splat(0.5f));
+            }
+            tap_commit(tap_ring);
+        }
+
+        mixer_interleave(left, right, samples + i * NUMBER_OF_CHANNELS, count);
+        i += count;
+    }
+}
+
+// Places the track at the end of the first count steps.
+static bool track_walk_steps(Song *song, size_t track, size_t count, StepReader reader, TrackState *state) {
+    bool is_exact = true;
+    for (size_t step = 0; step < count; step++) {
+        Setting from = *track_setting(song, song_row(song, reader, step, true), track);
+        Setting to = *track_setting(song, song_row(song, reader, (step + 1) % song->settings_count, true), track);
+        uint64_t step_frames = song->tempo.boundaries[step + 1] - song->tempo.boundaries[step];
+        is_exact = graph_place_phases(&song->tracks[track], state, &from, &to, step_frames, step_frames,
+            (float)song->tempo.sample_rate) && is_exact;
+    }
+    return is_exact;
+}
+
+// Phases of the track at the frame, as rendering the song from its start
+// leaves them, in O(steps). Rendering can start from there anywhere in the
+// song. Returns false for polyphonic tracks and ones with modulated
+// oscillators, those have to be rendered up to the frame. Inside of a ramp
+// the phases are exact, rendering is off from them by its rounding.
+bool track_phases_at(Song *song, size_t track, uint64_t frame, StepReader reader, TrackState *state) {
+    const TempoMap *tempo = &song->tempo;
+    const TrackInfo *info = &song->tracks[track];
+    uint64_t song_frames = tempo_song_frames(tempo);
+    uint64_t loops = info->reset_on_loop ? 0 : frame / song_frames;
+    frame %= song_frames;
+    size_t position = tempo_find_step(tempo, frame);
+    *state = (TrackState) {0};
+    if (info->polyphony > 0) return false;
+
+    bool is_exact = true;
+    if (loops > 0) {
+        // every time through the song moves the phases by the same amount
+        is_exact = track_walk_steps(song, track, song->settings_count, reader, state);
+        for (size_t n = 0; n < GRAPH_MAX_NODES; n++) {
+            state->phases[n] *= (uint32_t)loops;
+            state->step_phases[n] = state->phases[n];
+        }
+    }
+    is_exact = track_walk_steps(song, track, position, reader, state) && is_exact;
+
+    Setting from = *track_setting(song, song_row(song, reader, position, true), track);
+    Setting to = *track_setting(song, song_row(song, reader, (position + 1) % song->settings_count, true), track);
+    uint64_t step_start = tempo->boundaries[position];
+    graph_place_phases(info, state, &from, &to, tempo->boundaries[position + 1] - step_start, frame - step_start,
+        (float)tempo->sample_rate);
+    return is_exact;
+}
@@ -0,0 +1,156 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "simd.h"
+
+// Track filters are state variable filters in the trapezoidal (TPT) form,
+// which stays stable while the cutoff moves. One filter gives every
+// response as a mix of its input, band and low pass outputs.
+//
+// Filters run four tracks at a time, a track in every lane of a vector. The
+// signals of four tracks are transposed four frames at a time, so the inner
+// loop steps four filters through one frame per vector operation.
+//
+// The cutoff comes from the step settings once per block. It is smoothed
+// from block to block, and g goes in a straight line over the block from
+// where the last one ended, so automation does not step.
+
+#define FILTER_LANES 4
+#define FILTER_MIN_CUTOFF 10.0f
+#define FILTER_SMOOTHING 0.5f // of the way to the new cutoff per block
+
+typedef enum {
+    FILTER_NONE,
+    FILTER_LOWPASS,
+    FILTER_HIGHPASS,
+    FILTER_BANDPASS, // 0 dB at the cutoff
+    FILTER_PEAK,     // gain at the cutoff, 0 dB elsewhere
+    FILTER_COUNT,
+} FilterKind;
+
+static const char *filter_names[FILTER_COUNT] = {
+    [FILTER_NONE] = "none",
+    [FILTER_LOWPASS] = "lowpass",
+    [FILTER_HIGHPASS] = "highpass",
+    [FILTER_BANDPASS] = "bandpass",
+    [FILTER_PEAK] = "peak",
+};
+
+// Per track in the song file.
+typedef struct {
+    uint32_t kind; // FilterKind
+    float q;
+    float gain_db; // of the peak
+} FilterSettings;
+
+// Per track, 0 is a filter at rest.
+typedef struct {
+    float ic1;
+    float ic2;
+    float cutoff; // smoothed, 0 before the first block
+} FilterState;
+
+bool filter_find(const char *name, FilterKind *kind) {
+    for (int k = 0; k < FILTER_COUNT; k++) {
+        if (strcmp(filter_names[k], name) == 0) {
+            *kind = k;
+            return true;
+        }
+    }
+    return false;
+}
+
+// a b c d, e f g h, ... into a e i m, b f j n, ...
+static inline void filter_transpose(f32x4 *rows) {
+    f32x4 t0 = __builtin_shufflevector(rows[0], rows[1], 0, 4, 1, 5);
+    f32x4 t1 = __builtin_shufflevector(rows[0], rows[1], 2, 6, 3, 7);
+    f32x4 t2 = __builtin_shufflevector(rows[2], rows[3], 0, 4, 1, 5);
+    f32x4 t3 = __builtin_shufflevector(rows[2], rows[3], 2, 6, 3, 7);
+    rows[0] = __builtin_shufflevector(t0, t2, 0, 1, 4, 5);
+    rows[1] = __builtin_shufflevector(t0, t2, 2, 3, 6, 7);
+    rows[2] = __builtin_shufflevector(t1, t3, 0, 1, 4, 5);
+    rows[3] = __builtin_shufflevector(t1, t3, 2, 3, 6, 7);
+}
+
+// Filters count frames of up to FILTER_LANES tracks in place, signals are
+// FILTER_LANES rows of at least count rounded up to 4. Cutoffs are the
+// targets of this block in Hz. Returns false without touching anything if
+// no track has a filter.
+bool filter_process(const FilterSettings *const *settings, const float *cutoffs, FilterState *const *states,
+                    float *const *signals, size_t lanes, float sample_rate, size_t count) {
+    bool has_filter = false;
+    for (size_t lane = 0; lane < lanes; lane++) has_filter = has_filter || settings[lane]->kind != FILTER_NONE;
+    if (!has_filter) return false;
+
+    f32x4 g_start = {0}, g_end = {0}, k = {0}, m0 = {0}, m1 = {0}, m2 = {0}, ic1 = {0}, ic2 = {0};
+    for (size_t lane = 0; lane < FILTER_LANES; lane++) {
+        FilterKind kind = lane < lanes ? settings[lane]->kind : FILTER_NONE;
+        if (kind == FILTER_NONE) {
+            m0[lane] = 1;
+            k[lane] = 1;
+            continue;
+        }
+
+        FilterState *state = states[lane];
+        float cutoff = fminf(fmaxf(cutoffs[lane], FILTER_MIN_CUTOFF), 0.49f * sample_rate);
+        float previous = state->cutoff != 0 ? state->cutoff : cutoff;
+        state->cutoff = previous + (cutoff - previous) * FILTER_SMOOTHING;
+        g_start[lane] = tanf(PI * previous / sample_rate);
+        g_end[lane] = tanf(PI * state->cutoff / sample_rate);
+        ic1[lane] = state->ic1;
+        ic2[lane] = state->ic2;
+
+        float q = settings[lane]->q > 0 ? settings[lane]->q : 0.7071f;
+        k[lane] = 1 / q;
+        switch (kind) {
+        case FILTER_LOWPASS:  m2[lane] = 1; break;
+        case FILTER_HIGHPASS: m0[lane] = 1; m1[lane] = -k[lane]; m2[lane] = -1; break;
+        case FILTER_BANDPASS: m1[lane] = k[lane]; break;
+        case FILTER_PEAK: {
+            float a = powf(10, settings[lane]->gain_db / 40);
+            k[lane] = 1 / (q * a);
+            m0[lane] = 1;
+            m1[lane] = k[lane] * (a * a - 1);
+        } break;
+        default: break;
+        }
+    }
+
+    f32x4 g_step = (g_end - g_start) / f32x4_splat(count);
+    f32x4 one = f32x4_splat(1), two = f32x4_splat(2);
+    for (size_t j = 0; j < count; j += 4) {
+        f32x4 frames[FILTER_LANES];
+        for (size_t lane = 0; lane < FILTER_LANES; lane++) frames[lane] = f32x4_load(signals[lane] + j);
+        filter_transpose(frames);
+
+        for (size_t i = 0; i < 4; i++) {
+            f32x4 g = g_start + g_step * f32x4_splat(j + i + 1);
+            f32x4 a1 = one / (one + g * (g + k));
+            f32x4 a2 = g * a1;
+            f32x4 a3 = g * a2;
+
+            f32x4 x = frames[i];
+            f32x4 v3 = x - ic2;
+            f32x4 v1 = a1 * ic1 + a2 * v3;
+            f32x4 v2 = ic2 + a2 * ic1 + a3 * v3;
+            // frames past count are filtered too but their state is dropped
+            if (j + i < count) {
+                ic1 = two * v1 - ic1;
+                ic2 = two * v2 - ic2;
+            }
+            frames[i] = m0 * x + m1 * v1 + m2 * v2;
+        }
+
+        filter_transpose(frames);
+        for (size_t lane = 0; lane < FILTER_LANES; lane++) f32x4_store(signals[lane] + j, frames[lane]);
+    }
+
+    for (size_t lane = 0; lane < lanes; lane++) {
+        if (settings[lane]->kind == FILTER_NONE) continue;
+        states[lane]->ic1 = ic1[lane];
+        states[lane]->ic2 = ic2[lane];
+    }
+    return true;
+}
@@ -0,0 +1,281 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "simd.h"
+
+// Voice graphs are rendered node by node, a whole block at a time. Every
+// node writes its output into its own row of one contiguous buffer, so the
+// dispatch on node kind happens once per block and the inner loops are plain
+// array loops.
+//
+// With ENGINE_FUSED_KERNELS tracks that kept the graph of their preset are
+// rendered by hand fused kernels instead, which keep intermediate signals in
+// registers. Graphs written in the song always go node by node.
+//
+// Phases are 32 bit fixed point, a whole turn is 2^32 and wraps around by
+// itself. Oscillators that play a step parameter are put exactly where the
+// step leaves them at every step boundary, so the phase at any frame follows
+// from the song alone and rounding does not pile up over a long song.
+
+#ifndef ENGINE_FUSED_KERNELS
+#define ENGINE_FUSED_KERNELS 1
+#endif
+
+#define PHASE_TURN 4294967296.0f // 2^32
+#define PHASE_TO_UNIT (1.0f / PHASE_TURN)
+
+typedef struct {
+    uint32_t phases[GRAPH_MAX_NODES];
+    uint32_t step_phases[GRAPH_MAX_NODES]; // at the start of the step
+    FilterState filter;
+    VoicePool voices; // polyphonic tracks only
+} TrackState;
+
+typedef struct {
+    float nodes[GRAPH_MAX_NODES][ENGINE_BLOCK_SIZE];
+} GraphBuffers;
+
+// Phase as a signed fraction of a turn, -0.5..0.5.
+static inline float phase_unit(uint32_t phase) {
+    return (float)(int32_t)phase * PHASE_TO_UNIT;
+}
+
+float sine_wave(uint32_t phase) {
+    return sinf(2.0f * PI * phase_unit(phase));
+}
+
+float triangle_wave(uint32_t phase) {
+    return 2.0f * fabsf(2.0f * phase_unit(phase)) - 1.0f;
+}
+
+float square_wave(uint32_t phase) {
+    return phase < 0x80000000u ? 1.0f : -1.0f;
+}
+
+// Phase units per frame at the frequency, scale is PHASE_TURN / sample rate.
+// Negative frequencies and ones over the sample rate wrap around.
+static inline uint32_t phase_increment(float frequency, float scale) {
+    return (uint32_t)(int64_t)(frequency * scale);
+}
+
+#define OSCILLATOR_LOOP(wave)                                  \
+    for (size_t i = 0; i < count; i++) {                       \
+        out[i] = wave(phase);                                  \
+        phase += phase_increment(frequency[i], phase_scale);   \
+    }
+
+static void render_oscillator(float *out, const float *frequency, uint32_t *phase_state, WaveShape shape,
+                              float phase_scale, size_t count) {
+    uint32_t phase = *phase_state;
+    switch (shape) {
+    case WAVE_SINE:     OSCILLATOR_LOOP(sine_wave);     break;
+    case WAVE_TRIANGLE: OSCILLATOR_LOOP(triangle_wave); break;
+    case WAVE_SQUARE:   OSCILLATOR_LOOP(square_wave);   break;
+    }
+    *phase_state = phase;
+}
+
+static void render_modulator(float *out, const float *in, float scale, float offset, size_t count) {
+    f32x4 scales = f32x4_splat(scale);
+    f32x4 offsets = f32x4_splat(offset);
+    for (size_t i = 0; i < count; i += 4) {
+        f32x4_store(out + i, f32x4_load(in + i) * scales + offsets);
+    }
+}
+
+static void render_multiply(float *out, const float *a, const float *b, size_t count) {
+    for (size_t i = 0; i < count; i += 4) {
+        f32x4_store(out + i, f32x4_load(a + i) * f32x4_load(b + i));
+    }
+}
+
+#if ENGINE_FUSED_KERNELS
+// Phases are indexed by the node of the sorted preset graph that owns them.
+static void render_fused_bass(const TrackInfo *track, uint32_t *phases, const SettingBlock *settings,
+                              float phase_scale, float *out, size_t count) {
+    uint32_t *phase1 = NULL, *phase2 = NULL, *phase3 = NULL;
+    for (size_t n = 0; n < track->node_count; n++) {
+        const Node *node = &track->nodes[n];
+        if (node->kind != NODE_OSCILLATOR) continue;
+        const Node *input = &track->nodes[node->input1];
+        if (input->kind == NODE_MULTIPLY)  phase1 = &phases[n];
+        else if (input->input1 == 1)       phase2 = &phases[n];
+        else                               phase3 = &phases[n];
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        float signal1 = sine_wave(*phase1);
+        float signal2 = sine_wave(*phase2) * 0.5f + 0.5f;
+        float signal3 = sine_wave(*phase3) * 0.5f + 0.5f;
+        out[i] = signal1 * signal2;
+
+        *phase1 += phase_increment(settings->wave1[i] * signal3, phase_scale);
+        *phase2 += phase_increment(settings->wave2[i], phase_scale);
+        *phase3 += phase_increment(settings->wave3[i], phase_scale);
+    }
+}
+
+static void render_fused_beeps(const TrackInfo *track, uint32_t *phases, const SettingBlock *settings,
+                               float phase_scale, float *out, size_t count) {
+    uint32_t *phase1 = NULL, *phase2 = NULL, *phase3 = NULL;
+    for (size_t n = 0; n < track->node_count; n++) {
+        const Node *node = &track->nodes[n];
+        if (node->kind != NODE_OSCILLATOR) continue;
+        const Node *input = &track->nodes[node->input1];
+        if (input->input1 == 0)      phase1 = &phases[n];
+        else if (input->input1 == 1) phase2 = &phases[n];
+        else                         phase3 = &phases[n];
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        float signal1 = sine_wave(*phase1);
+        float signal2 = square_wave(*phase2) * 0.5f + 0.5f;
+        float signal3 = square_wave(*phase3) * 0.5f + 0.5f;
+        out[i] = signal1 * signal2 * signal3;
+
+        *phase1 += phase_increment(settings->wave1[i], phase_scale);
+        *phase2 += phase_increment(settings->wave2[i], phase_scale);
+        *phase3 += phase_increment(settings->wave3[i], phase_scale);
+    }
+}
+
+static void render_fused_beat(const TrackInfo *track, uint32_t *phases, const SettingBlock *settings,
+                              float phase_scale, float *out, size_t count) {
+    uint32_t *phase1 = NULL, *phase2 = NULL;
+    for (size_t n = 0; n < track->node_count; n++) {
+        const Node *node = &track->nodes[n];
+        if (node->kind != NODE_OSCILLATOR) continue;
+        if (node->shape == WAVE_TRIANGLE) phase1 = &phases[n];
+        else                              phase2 = &phases[n];
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        float signal1 = triangle_wave(*phase1);
+        float signal2 = sine_wave(*phase2) * 0.5f + 0.5f;
+        out[i] = signal1 * signal2;
+
+        *phase1 += phase_increment(settings->wave1[i], phase_scale);
+        *phase2 += phase_increment(settings->wave2[i], phase_scale);
+    }
+}
+#endif // ENGINE_FUSED_KERNELS
+
+// Renders count frames of the track from its phases, returns its output signal.
+// is_fused says the track has the graph of its voice preset.
+const float *graph_render(const TrackInfo *track, bool is_fused, uint32_t *phases, const SettingBlock *settings,
+                          float sample_rate, GraphBuffers *buffers, size_t count) {
+    float phase_scale = PHASE_TURN / sample_rate;
+#if ENGINE_FUSED_KERNELS
+    float *out = buffers->nodes[track->output];
+    if (is_fused) {
+        switch (track->voice) {
+        case VOICE_BASS:  render_fused_bass(track, phases, settings, phase_scale, out, count);  return out;
+        case VOICE_BEEPS: render_fused_beeps(track, phases, settings, phase_scale, out, count); return out;
+        case VOICE_BEAT:  render_fused_beat(track, phases, settings, phase_scale, out, count);  return out;
+        }
+    }
+#endif
+
+    const float *params[3] = { settings->wave1, settings->wave2, settings->wave3 };
+    const float *outputs[GRAPH_MAX_NODES];
+
+    for (size_t n = 0; n < track->node_count; n++) {
+        const Node *node = &track->nodes[n];
+        float *out = buffers->nodes[n];
+        outputs[n] = out;
+
+        switch (node->kind) {
+        case NODE_PARAM:
+            outputs[n] = params[node->input1];
+            break;
+        case NODE_OSCILLATOR:
+            render_oscillator(out, outputs[node->input1], &phases[n], node->shape, phase_scale, count);
+            break;
+        case NODE_MODULATOR:
+            render_modulator(out, outputs[node->input1], node->scale, node->offset, count);
+            break;
+        case NODE_MULTIPLY:
+            render_multiply(out, outputs[node->input1], outputs[node->input2], count);
+            break;
+        }
+    }
+
+    return outputs[track->output];
+}
+
+// Renders the live voices of a polyphonic track into out, count rounded up to
+// 4 values. Every voice plays the track's graph with its own note as wave1.
+void graph_render_voices(const TrackInfo *track, bool is_fused, TrackState *state, const Setting *setting,
+                         size_t position, const SettingBlock *settings, float sample_rate, GraphBuffers *buffers,
+                         float *out, size_t count) {
+    VoicePool *pool = &state->voices;
+    voice_pool_step(pool, track->polyphony, setting, position);
+    memset(out, 0, ((count + 3) & ~(size_t)3) * sizeof(float));
+    if (pool->active_count == 0) return;
+
+    SettingBlock voice = *settings;
+    size_t i = 0;
+    while (i < pool->active_count) {
+        size_t v = pool->active[i];
+        uint32_t phases[GRAPH_MAX_NODES];
+        for (size_t n = 0; n < track->node_count; n++) phases[n] = pool->phases[n][v];
+        for (size_t j = 0; j < count; j++) voice.wave1[j] = pool->frequency[v];
+
+        const float *signal = graph_render(track, is_fused, phases, &voice, sample_rate, buffers, count);
+        for (size_t n = 0; n < track->node_count; n++) pool->phases[n][v] = phases[n];
+
+        if (voice_pool_envelope(pool, v, track->release, sample_rate, signal, out, count)) {
+            i++;
+        } else {
+            voice_pool_free(pool, i);
+        }
+    }
+}
+
+// Step value of a parameter, wave1..wave3.
+static void setting_param(const Setting *setting, size_t param, float *value, Ramp *ramp) {
+    switch (param) {
+    case 0:  *value = setting->wave1; *ramp = setting->ramp1; break;
+    case 1:  *value = setting->wave2; *ramp = setting->ramp2; break;
+    default: *value = setting->wave3; *ramp = setting->ramp3; break;
+    }
+}
+
+// Phase units an oscillator playing the parameter moves through in the first
+// frames of a step of step_frames. A held value adds up just like in the
+// kernels, a ramp is summed in closed form.
+static uint32_t phase_advance(float from, float to, Ramp ramp, uint64_t step_frames, uint64_t frames, float sample_rate) {
+    float scale = PHASE_TURN / sample_rate;
+    if (ramp == RAMP_NONE) return phase_increment(from, scale) * (uint32_t)frames;
+    double units = automation_sum(from, to, ramp, step_frames, frames) * (double)scale;
+    return (uint32_t)(int64_t)fmod(units, PHASE_TURN);
+}
+
+// Puts the oscillators that play a step parameter frames into the step, from
+// the phases they started it with. At the end of the step those become the
+// start of the next one. Returns false if the track has oscillators that are
+// modulated by others, those only get their phases from rendering.
+bool graph_place_phases(const TrackInfo *track, TrackState *state, const Setting *from, const Setting *to,
+                        uint64_t step_frames, uint64_t frames, float sample_rate) {
+    bool is_exact = true;
+    for (size_t n = 0; n < track->node_count; n++) {
+        const Node *node = &track->nodes[n];
+        if (node->kind != NODE_OSCILLATOR) continue;
+        const Node *input = &track->nodes[node->input1];
+        if (input->kind != NODE_PARAM) {
+            is_exact = false;
+            continue;
+        }
+
+        float value, next;
+        Ramp ramp, next_ramp;
+        setting_param(from, input->input1, &value, &ramp);
+        setting_param(to, input->input1, &next, &next_ramp);
+        state->phases[n] = state->step_phases[n] + phase_advance(value, next, ramp, step_frames, frames, sample_rate);
+        if (frames == step_frames) state->step_phases[n] = state->phases[n];
+    }
+    return is_exact;
+}
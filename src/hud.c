@@ -0,0 +1,208 @@
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "raylib.h"
+
+// Frame-time overlay. Every frame records how long its phases took into a
+// ring of the last FRAME_HISTORY frames, the overlay draws them as stacked
+// columns with percentiles of the whole frame. Recording is a few clock
+// reads per frame and is always on, only drawing is toggled.
+//
+// Phases are laps: frame_times_lap charges the time since the previous lap
+// to a phase. A frame lasts from one frame_times_begin to the next, so the
+// time the host spends between updates is part of it.
+
+#define FRAME_HISTORY 240
+#define FRAME_GRAPH_MS 50.0f // top of the graph
+
+typedef enum {
+    PHASE_RELOAD,   // song reload check and the host between updates
+    PHASE_INPUT,
+    PHASE_DRAW,     // DrawFrame
+    PHASE_READBACK,
+    PHASE_PIPE,     // writes into ffmpeg
+    PHASE_SWAP,     // EndDrawing, includes waiting for vsync
+    PHASE_OTHER,
+    PHASE_COUNT,
+} FramePhase;
+
+static const char *frame_phase_names[PHASE_COUNT] = {
+    "reload", "input", "draw", "readback", "pipe", "swap", "other",
+};
+
+static const Color frame_phase_colors[PHASE_COUNT] = {
+    { 130, 130, 130, 255 },
+    { 230, 200,  60, 255 },
+    {  80, 170, 255, 255 },
+    { 230,  90, 200, 255 },
+    { 250, 130,  40, 255 },
+    {  90, 210, 110, 255 },
+    {  60,  60,  60, 255 },
+};
+
+typedef struct {
+    float phases[FRAME_HISTORY][PHASE_COUNT]; // seconds
+    float totals[FRAME_HISTORY];
+    float works[FRAME_HISTORY];               // without the swap and the host
+    float audio_loads[FRAME_HISTORY];         // peak of the callbacks in the frame
+    size_t cursor;                            // next frame to write
+    size_t count;
+
+    double frame_start; // 0 before the first frame
+    double lap_start;
+    double frame_end;
+    float current[PHASE_COUNT];
+    float current_audio_load;
+} FrameTimes;
+
+double frame_times_now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+// Finishes the previous frame and starts a new one.
+void frame_times_begin(FrameTimes *frame_times) {
+    double now = frame_times_now();
+
+    if (frame_times->frame_start != 0) {
+        size_t i = frame_times->cursor;
+        float work = 0;
+        for (size_t p = 0; p < PHASE_COUNT; p++) work += p != PHASE_SWAP ? frame_times->current[p] : 0;
+        frame_times->works[i] = work;
+        frame_times->current[PHASE_RELOAD] += now - frame_times->frame_end;
+
+        memcpy(frame_times->phases[i], frame_times->current, sizeof(frame_times->current));
+        frame_times->totals[i] = now - frame_times->frame_start;
+        frame_times->audio_loads[i] = frame_times->current_audio_load;
+        frame_times->cursor = (i + 1) % FRAME_HISTORY;
+        if (frame_times->count < FRAME_HISTORY) frame_times->count++;
+    }
+
+    memset(frame_times->current, 0, sizeof(frame_times->current));
+    frame_times->current_audio_load = 0;
+    frame_times->frame_start = now;
+    frame_times->lap_start = now;
+    frame_times->frame_end = now;
+}
+
+void frame_times_lap(FrameTimes *frame_times, FramePhase phase) {
+    double now = frame_times_now();
+    frame_times->current[phase] += now - frame_times->lap_start;
+    frame_times->lap_start = now;
+}
+
+// Time the last finished frame spent on its own work, waiting for vsync and
+// the host are left out. 0 before the first frame.
+float frame_times_last_work(const FrameTimes *frame_times) {
+    if (frame_times->count == 0) return 0;
+    return frame_times->works[(frame_times->cursor + FRAME_HISTORY - 1) % FRAME_HISTORY];
+}
+
+// Call last in the update, the time until the next begin is the reload phase.
+void frame_times_end(FrameTimes *frame_times) {
+    frame_times_lap(frame_times, PHASE_OTHER);
+    frame_times->frame_end = frame_times->lap_start;
+}
+
+// Peak load reported by the audio thread, time spent rendering over the
+// duration of the rendered period.
+void frame_times_audio_load(FrameTimes *frame_times, _Atomic(float) *peak) {
+    frame_times->current_audio_load = atomic_exchange(peak, 0.0f);
+}
+
+void audio_load_report(_Atomic(float) *peak, float load) {
+    float previous = atomic_load(peak);
+    while (load > previous && !atomic_compare_exchange_weak(peak, &previous, load)) {}
+}
+
+static int frame_times_compare(const void *a, const void *b) {
+    float x = *(const float *)a, y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+// p in [0, 1], in seconds.
+static float frame_times_percentile(const float *sorted, size_t count, float p) {
+    size_t index = (size_t)ceilf(p * count);
+    return sorted[index > 0 ? index - 1 : 0];
+}
+
+// Compact line shown in place of the overlay.
+void frame_times_draw_summary(const FrameTimes *frame_times, int x, int y) {
+    if (frame_times->count == 0) return;
+    size_t last = (frame_times->cursor + FRAME_HISTORY - 1) % FRAME_HISTORY;
+    char text[64];
+    sprintf(text, "%.1f ms", frame_times->totals[last] * 1000);
+    DrawText(text, x, y, 20, LIME);
+}
+
+// Queued bytes of the encoder are negative when not exporting.
+void frame_times_draw(const FrameTimes *frame_times, Rectangle area, long encoder_queue) {
+    DrawRectangleRec(area, (Color) { 0, 0, 0, 180 });
+    if (frame_times->count == 0) return;
+
+    // columns, oldest on the left
+    Rectangle graph = { area.x + 8, area.y + 8, area.width - 16, area.height - 140 };
+    float column = graph.width / FRAME_HISTORY;
+    float pixels_per_second = graph.height / (FRAME_GRAPH_MS / 1000);
+    size_t first = (frame_times->cursor + FRAME_HISTORY - frame_times->count) % FRAME_HISTORY;
+
+    for (size_t n = 0; n < frame_times->count; n++) {
+        size_t i = (first + n) % FRAME_HISTORY;
+        float x = graph.x + (FRAME_HISTORY - frame_times->count + n) * column;
+        float bottom = graph.y + graph.height;
+
+        for (size_t p = 0; p < PHASE_COUNT; p++) {
+            float height = frame_times->phases[i][p] * pixels_per_second;
+            if (bottom - height < graph.y) height = bottom - graph.y;
+            if (height <= 0) continue;
+            DrawRectangleRec((Rectangle) { x, bottom - height, column, height }, frame_phase_colors[p]);
+            bottom -= height;
+        }
+    }
+
+    // 60 fps
+    float target_y = graph.y + graph.height - pixels_per_second / 60;
+    DrawLineV((Vector2) { graph.x, target_y }, (Vector2) { graph.x + graph.width, target_y }, RED);
+
+    float sorted[FRAME_HISTORY];
+    float averages[PHASE_COUNT] = {0};
+    float audio_average = 0, audio_peak = 0;
+    for (size_t n = 0; n < frame_times->count; n++) {
+        size_t i = (first + n) % FRAME_HISTORY;
+        sorted[n] = frame_times->totals[i];
+        for (size_t p = 0; p < PHASE_COUNT; p++) averages[p] += frame_times->phases[i][p] / frame_times->count;
+        audio_average += frame_times->audio_loads[i] / frame_times->count;
+        if (frame_times->audio_loads[i] > audio_peak) audio_peak = frame_times->audio_loads[i];
+    }
+    qsort(sorted, frame_times->count, sizeof(float), frame_times_compare);
+
+    char text[128];
+    float text_y = graph.y + graph.height + 8;
+    sprintf(text, "frame p50 %.2f  p95 %.2f  p99 %.2f ms",
+            frame_times_percentile(sorted, frame_times->count, 0.50f) * 1000,
+            frame_times_percentile(sorted, frame_times->count, 0.95f) * 1000,
+            frame_times_percentile(sorted, frame_times->count, 0.99f) * 1000);
+    DrawText(text, graph.x, text_y, 20, WHITE);
+
+    // average of every phase, four to a row
+    for (size_t p = 0; p < PHASE_COUNT; p++) {
+        float x = graph.x + (p % 4) * (graph.width / 4);
+        float y = text_y + 26 + (p / 4) * 20;
+        DrawRectangleRec((Rectangle) { x, y + 4, 10, 10 }, frame_phase_colors[p]);
+        sprintf(text, "%s %.2f", frame_phase_names[p], averages[p] * 1000);
+        DrawText(text, x + 14, y, 16, WHITE);
+    }
+
+    if (encoder_queue >= 0) {
+        sprintf(text, "audio %3.0f%% (peak %3.0f%%)  encoder queue %ld KiB",
+                audio_average * 100, audio_peak * 100, encoder_queue / 1024);
+    } else {
+        sprintf(text, "audio %3.0f%% (peak %3.0f%%)", audio_average * 100, audio_peak * 100);
+    }
+    DrawText(text, graph.x, text_y + 72, 16, WHITE);
+}
@@ -0,0 +1,180 @@
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Lookahead brickwall limiter on the master bus. The output is delayed by
+// the lookahead, so the gain can come down before a peak arrives:
+//
+//   needed gain per frame -> minimum over the lookahead window -> release
+//   -> moving average over the lookahead -> multiplies the delayed frame
+//
+// The window minimum keeps a monotonic deque of frames, every frame enters
+// and leaves it once. The average of gains that are all below the one a
+// frame needs is below it too, so the output never exceeds the ceiling and
+// the attack is a smooth ramp.
+//
+// With true peak on, peaks between samples are estimated by upsampling 4x
+// with a short polyphase filter. The filter lags TRUE_PEAK_DELAY
+// frames, peaks are always taken that late so toggling it does not move the
+// output.
+
+#define LIMITER_MAX_LOOKAHEAD 2048 // frames
+#define TRUE_PEAK_TAPS 8
+#define TRUE_PEAK_DELAY (TRUE_PEAK_TAPS / 2)
+#define LIMITER_DELAY_CAPACITY (LIMITER_MAX_LOOKAHEAD + TRUE_PEAK_DELAY)
+
+// 4x upsampling filter, phases 1-3 of a windowed sinc, phase 0 is the
+// sample. Lives in the state so it survives a reload.
+typedef struct {
+    float phases[3][TRUE_PEAK_TAPS];
+    float history[TRUE_PEAK_TAPS][NUMBER_OF_CHANNELS];
+} TruePeak;
+
+typedef struct {
+    float ceiling;       // linear
+    float release;       // per frame coefficient
+    size_t lookahead;    // frames
+    _Atomic(bool) is_enabled;
+    _Atomic(bool) is_true_peak;
+    _Atomic(bool) is_reset_requested;
+    _Atomic(float) lowest_gain; // of the last block, for display
+
+    // audio thread
+    float delay[LIMITER_DELAY_CAPACITY][NUMBER_OF_CHANNELS];
+    TruePeak true_peak;
+    float needed[LIMITER_MAX_LOOKAHEAD + 1];  // gain every frame of the window needs, by frame
+    size_t deque[LIMITER_MAX_LOOKAHEAD + 1];  // frames with increasing needed gain
+    size_t deque_first;
+    size_t deque_count;
+    float averaged[LIMITER_MAX_LOOKAHEAD];    // released gains of the average
+    double averaged_sum;
+    float gain;                               // after release
+    uint64_t frame;
+} Limiter;
+
+void true_peak_init(TruePeak *true_peak) {
+    memset(true_peak->history, 0, sizeof(true_peak->history));
+    for (size_t p = 0; p < 3; p++) {
+        float sum = 0;
+        for (size_t t = 0; t < TRUE_PEAK_TAPS; t++) {
+            float x = (float)t - (TRUE_PEAK_DELAY - 1) - (p + 1) / 4.0f;
+            float sinc = x == 0 ? 1 : sinf(PI * x) / (PI * x);
+            float window = 0.5f + 0.5f * cosf(PI * x / (TRUE_PEAK_DELAY + 1));
+            true_peak->phases[p][t] = sinc * window;
+            sum += true_peak->phases[p][t];
+        }
+        for (size_t t = 0; t < TRUE_PEAK_TAPS; t++) true_peak->phases[p][t] /= sum;
+    }
+}
+
+// Peak of the frame that came in TRUE_PEAK_DELAY frames ago, with
+// interpolate also the points between it and the next one.
+float true_peak_push(TruePeak *true_peak, const float *frame, bool interpolate) {
+    memmove(true_peak->history[0], true_peak->history[1], sizeof(true_peak->history) - sizeof(true_peak->history[0]));
+    memcpy(true_peak->history[TRUE_PEAK_TAPS - 1], frame, sizeof(true_peak->history[0]));
+
+    float peak = 0;
+    for (size_t c = 0; c < NUMBER_OF_CHANNELS; c++) {
+        peak = fmaxf(peak, fabsf(true_peak->history[TRUE_PEAK_DELAY - 1][c]));
+        if (!interpolate) continue;
+        for (size_t p = 0; p < 3; p++) {
+            float value = 0;
+            for (size_t t = 0; t < TRUE_PEAK_TAPS; t++) value += true_peak->phases[p][t] * true_peak->history[t][c];
+            peak = fmaxf(peak, fabsf(value));
+        }
+    }
+    return peak;
+}
+
+static void limiter_reset(Limiter *limiter) {
+    memset(limiter->delay, 0, sizeof(limiter->delay));
+    memset(limiter->true_peak.history, 0, sizeof(limiter->true_peak.history));
+    limiter->deque_first = 0;
+    limiter->deque_count = 0;
+    for (size_t i = 0; i < LIMITER_MAX_LOOKAHEAD; i++) limiter->averaged[i] = 1;
+    limiter->averaged_sum = limiter->lookahead;
+    limiter->gain = 1;
+    limiter->frame = 0;
+    atomic_store(&limiter->lowest_gain, 1.0f);
+}
+
+void limiter_init(Limiter *limiter, size_t sample_rate, float ceiling_db, float lookahead_ms, float release_ms) {
+    limiter->ceiling = powf(10, ceiling_db / 20);
+    limiter->release = 1 - expf(-1.0f / (release_ms / 1000 * sample_rate));
+    limiter->lookahead = (size_t)(lookahead_ms / 1000 * sample_rate);
+    if (limiter->lookahead < 1) limiter->lookahead = 1;
+    if (limiter->lookahead > LIMITER_MAX_LOOKAHEAD) limiter->lookahead = LIMITER_MAX_LOOKAHEAD;
+    atomic_store(&limiter->is_enabled, true);
+    atomic_store(&limiter->is_true_peak, true);
+    true_peak_init(&limiter->true_peak);
+    limiter_reset(limiter);
+}
+
+// Frames the output is behind the input, a zeroed limiter passes through.
+size_t limiter_latency(const Limiter *limiter) {
+    if (limiter->lookahead == 0) return 0;
+    return limiter->lookahead + TRUE_PEAK_DELAY;
+}
+
+// Any thread, the audio thread clears the state before the next block.
+void limiter_request_reset(Limiter *limiter) {
+    atomic_store(&limiter->is_reset_requested, true);
+}
+
+// Limits interleaved frames in place, they come out limiter_latency later.
+void limiter_process(Limiter *limiter, float *samples, size_t frames_count) {
+    if (limiter->lookahead == 0) return;
+    if (atomic_exchange(&limiter->is_reset_requested, false)) limiter_reset(limiter);
+
+    bool is_enabled = atomic_load_explicit(&limiter->is_enabled, memory_order_relaxed);
+    bool is_true_peak = atomic_load_explicit(&limiter->is_true_peak, memory_order_relaxed);
+    size_t window = limiter->lookahead + 1;
+    size_t latency = limiter_latency(limiter);
+    float lowest_gain = 1;
+
+    for (size_t i = 0; i < frames_count; i++) {
+        float *frame = samples + i * NUMBER_OF_CHANNELS;
+        uint64_t n = limiter->frame++;
+
+        float peak = true_peak_push(&limiter->true_peak, frame, is_true_peak);
+        float needed = peak > limiter->ceiling ? limiter->ceiling / peak : 1;
+
+        // minimum over the window, frames that left it go from the front,
+        // larger gains from the back
+        if (limiter->deque_count > 0 && limiter->deque[limiter->deque_first] + window <= n) {
+            limiter->deque_first = (limiter->deque_first + 1) % window;
+            limiter->deque_count--;
+        }
+        while (limiter->deque_count > 0) {
+            size_t last = limiter->deque[(limiter->deque_first + limiter->deque_count - 1) % window];
+            if (limiter->needed[last % window] < needed) break;
+            limiter->deque_count--;
+        }
+        limiter->needed[n % window] = needed;
+        limiter->deque[(limiter->deque_first + limiter->deque_count) % window] = n;
+        limiter->deque_count++;
+        float minimum = limiter->needed[limiter->deque[limiter->deque_first] % window];
+
+        if (minimum < limiter->gain) {
+            limiter->gain = minimum;
+        } else {
+            limiter->gain += (minimum - limiter->gain) * limiter->release;
+        }
+
+        size_t slot = n % limiter->lookahead;
+        limiter->averaged_sum += limiter->gain - limiter->averaged[slot];
+        limiter->averaged[slot] = limiter->gain;
+        float gain = is_enabled ? fminf((float)(limiter->averaged_sum / limiter->lookahead), 1) : 1;
+        lowest_gain = fminf(lowest_gain, gain);
+
+        // the delay line hands out the frame from latency frames ago
+        float *delayed = limiter->delay[n % latency];
+        for (size_t c = 0; c < NUMBER_OF_CHANNELS; c++) {
+            float input = frame[c];
+            frame[c] = delayed[c] * gain;
+            delayed[c] = input;
+        }
+    }
+    atomic_store(&limiter->lowest_gain, lowest_gain);
+}
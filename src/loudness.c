@@ -0,0 +1,286 @@
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "simd.h"
+
+// EBU R128 loudness of the export, measured as the audio streams into the
+// encoder. Samples go through the K-weighting filter, two biquads with the
+// channels in the lanes of a vector, and their energy is summed into 100 ms
+// blocks. The last 30 blocks give the momentary (400 ms) and short-term (3 s)
+// loudness.
+//
+// Integrated loudness and loudness range are gated over the whole song, so
+// the loudness of every 400 ms and 3 s window is counted into a histogram
+// of 0.1 LU bins instead of being kept. The histogram of 400 ms windows also
+// sums their energy, only the bin the relative gate falls into is rounded.
+
+#define LOUDNESS_BLOCKS 30          // 100 ms blocks in the short-term window
+#define LOUDNESS_MOMENTARY_BLOCKS 4
+#define LOUDNESS_MIN_LUFS -70.0     // absolute gate
+#define LOUDNESS_MAX_LUFS 10.0
+#define LOUDNESS_BINS 800           // 0.1 LU each
+
+typedef struct {
+    f32x4 b[3], a[2]; // a0 is 1
+    f32x4 z[2];       // transposed direct form II state
+} LoudnessBiquad;
+
+typedef struct {
+    LoudnessBiquad shelf;
+    LoudnessBiquad high_pass;
+    size_t block_frames;
+    size_t block_filled;
+    double block_energy;              // sum of squares of the block being filled
+    double blocks[LOUDNESS_BLOCKS];   // mean square of the last blocks
+    size_t block_count;
+
+    uint64_t momentary_counts[LOUDNESS_BINS];
+    double momentary_energies[LOUDNESS_BINS];
+    uint64_t short_term_counts[LOUDNESS_BINS];
+
+    double momentary;      // LUFS, -HUGE_VAL before the first window
+    double short_term;
+    double max_momentary;
+    double max_short_term;
+    TruePeak true_peak;
+    float peak;            // linear
+} Loudness;
+
+static double loudness_lufs(double energy) {
+    return energy > 0 ? -0.691 + 10 * log10(energy) : -HUGE_VAL;
+}
+
+static double loudness_energy(double lufs) {
+    return pow(10, (lufs + 0.691) / 10);
+}
+
+static int loudness_bin(double lufs) {
+    if (lufs < LOUDNESS_MIN_LUFS) return -1;
+    int bin = (int)((lufs - LOUDNESS_MIN_LUFS) * LOUDNESS_BINS / (LOUDNESS_MAX_LUFS - LOUDNESS_MIN_LUFS));
+    return bin < LOUDNESS_BINS ? bin : LOUDNESS_BINS - 1;
+}
+
+static double loudness_bin_lufs(int bin) {
+    return LOUDNESS_MIN_LUFS + bin * (LOUDNESS_MAX_LUFS - LOUDNESS_MIN_LUFS) / LOUDNESS_BINS;
+}
+
+static LoudnessBiquad loudness_biquad(double b0, double b1, double b2, double a1, double a2) {
+    return (LoudnessBiquad) {
+        .b = { f32x4_splat(b0), f32x4_splat(b1), f32x4_splat(b2) },
+        .a = { f32x4_splat(a1), f32x4_splat(a2) },
+    };
+}
+
+static inline f32x4 loudness_biquad_process(LoudnessBiquad *biquad, f32x4 x) {
+    f32x4 y = biquad->b[0] * x + biquad->z[0];
+    biquad->z[0] = biquad->b[1] * x - biquad->a[0] * y + biquad->z[1];
+    biquad->z[1] = biquad->b[2] * x - biquad->a[1] * y;
+    return y;
+}
+
+// K-weighting for any sample rate, from the analog prototypes of BS.1770.
+void loudness_start(Loudness *loudness, size_t sample_rate) {
+    memset(loudness, 0, sizeof(*loudness));
+
+    double k = tan(M_PI * 1681.974450955533 / sample_rate);
+    double q = 0.7071752369554196;
+    double vh = pow(10, 3.999843853973347 / 20);
+    double vb = pow(vh, 0.4996667741545416);
+    double a0 = 1 + k / q + k * k;
+    loudness->shelf = loudness_biquad((vh + vb * k / q + k * k) / a0, 2 * (k * k - vh) / a0,
+                                      (vh - vb * k / q + k * k) / a0, 2 * (k * k - 1) / a0, (1 - k / q + k * k) / a0);
+
+    k = tan(M_PI * 38.13547087602444 / sample_rate);
+    q = 0.5003270373238773;
+    a0 = 1 + k / q + k * k;
+    loudness->high_pass = loudness_biquad(1, -2, 1, 2 * (k * k - 1) / a0, (1 - k / q + k * k) / a0);
+
+    loudness->block_frames = sample_rate / 10;
+    loudness->momentary = -HUGE_VAL;
+    loudness->short_term = -HUGE_VAL;
+    loudness->max_momentary = -HUGE_VAL;
+    loudness->max_short_term = -HUGE_VAL;
+    true_peak_init(&loudness->true_peak);
+}
+
+static void loudness_end_block(Loudness *loudness) {
+    memmove(loudness->blocks, loudness->blocks + 1, sizeof(loudness->blocks) - sizeof(loudness->blocks[0]));
+    loudness->blocks[LOUDNESS_BLOCKS - 1] = loudness->block_energy / loudness->block_frames;
+    loudness->block_energy = 0;
+    loudness->block_filled = 0;
+    loudness->block_count++;
+
+    if (loudness->block_count >= LOUDNESS_MOMENTARY_BLOCKS) {
+        double energy = 0;
+        for (size_t i = LOUDNESS_BLOCKS - LOUDNESS_MOMENTARY_BLOCKS; i < LOUDNESS_BLOCKS; i++) energy += loudness->blocks[i];
+        energy /= LOUDNESS_MOMENTARY_BLOCKS;
+        loudness->momentary = loudness_lufs(energy);
+        loudness->max_momentary = fmax(loudness->max_momentary, loudness->momentary);
+
+        int bin = loudness_bin(loudness->momentary);
+        if (bin >= 0) {
+            loudness->momentary_counts[bin]++;
+            loudness->momentary_energies[bin] += energy;
+        }
+    }
+
+    if (loudness->block_count >= LOUDNESS_BLOCKS) {
+        double energy = 0;
+        for (size_t i = 0; i < LOUDNESS_BLOCKS; i++) energy += loudness->blocks[i];
+        loudness->short_term = loudness_lufs(energy / LOUDNESS_BLOCKS);
+        loudness->max_short_term = fmax(loudness->max_short_term, loudness->short_term);
+
+        int bin = loudness_bin(loudness->short_term);
+        if (bin >= 0) loudness->short_term_counts[bin]++;
+    }
+}
+
+// Interleaved frames as they are written.
+void loudness_add(Loudness *loudness, const float *samples, size_t frames_count) {
+    for (size_t i = 0; i < frames_count; i++) {
+        const float *frame = samples + i * NUMBER_OF_CHANNELS;
+        loudness->peak = fmaxf(loudness->peak, true_peak_push(&loudness->true_peak, frame, true));
+
+        f32x4 x = {0};
+        memcpy(&x, frame, sizeof(float) * NUMBER_OF_CHANNELS);
+        f32x4 y = loudness_biquad_process(&loudness->high_pass, loudness_biquad_process(&loudness->shelf, x));
+        f32x4 squares = y * y;
+        loudness->block_energy += squares[0] + squares[1] + squares[2] + squares[3];
+
+        if (++loudness->block_filled == loudness->block_frames) loudness_end_block(loudness);
+    }
+}
+
+// Relative gate 10 LU under the loudness of the windows above the absolute gate.
+double loudness_integrated(const Loudness *loudness) {
+    uint64_t count = 0;
+    double energy = 0;
+    for (int bin = 0; bin < LOUDNESS_BINS; bin++) {
+        count += loudness->momentary_counts[bin];
+        energy += loudness->momentary_energies[bin];
+    }
+    if (count == 0) return -HUGE_VAL;
+
+    int gate = loudness_bin(loudness_lufs(energy / count) - 10);
+    if (gate < 0) gate = 0;
+    count = 0;
+    energy = 0;
+    for (int bin = gate; bin < LOUDNESS_BINS; bin++) {
+        count += loudness->momentary_counts[bin];
+        energy += loudness->momentary_energies[bin];
+    }
+    return loudness_lufs(energy / count);
+}
+
+// Spread between the 10th and 95th percentile of the short-term loudness,
+// gated 20 LU under its mean.
+double loudness_range(const Loudness *loudness) {
+    uint64_t count = 0;
+    double energy = 0;
+    for (int bin = 0; bin < LOUDNESS_BINS; bin++) {
+        count += loudness->short_term_counts[bin];
+        energy += loudness->short_term_counts[bin] * loudness_energy(loudness_bin_lufs(bin) + 0.05);
+    }
+    if (count == 0) return 0;
+
+    int gate = loudness_bin(loudness_lufs(energy / count) - 20);
+    if (gate < 0) gate = 0;
+    count = 0;
+    for (int bin = gate; bin < LOUDNESS_BINS; bin++) count += loudness->short_term_counts[bin];
+    if (count == 0) return 0;
+
+    uint64_t low_rank = (uint64_t)(count * 0.10), high_rank = (uint64_t)(count * 0.95);
+    int low = -1, high = -1;
+    uint64_t seen = 0;
+    for (int bin = gate; bin < LOUDNESS_BINS; bin++) {
+        seen += loudness->short_term_counts[bin];
+        if (low < 0 && seen > low_rank) low = bin;
+        if (high < 0 && seen > high_rank) high = bin;
+    }
+    if (high < 0) high = LOUDNESS_BINS - 1;
+    return loudness_bin_lufs(high) - loudness_bin_lufs(low);
+}
+
+double loudness_true_peak_db(const Loudness *loudness) {
+    return loudness->peak > 0 ? 20 * log10(loudness->peak) : -HUGE_VAL;
+}
+
+void loudness_report(const Loudness *loudness) {
+    printf("Loudness: integrated %.1f LUFS, range %.1f LU, true peak %.1f dBTP\n",
+           loudness_integrated(loudness), loudness_range(loudness), loudness_true_peak_db(loudness));
+    printf("          max momentary %.1f LUFS, max short-term %.1f LUFS\n",
+           loudness->max_momentary, loudness->max_short_term);
+}
+
+// Gain that brings the integrated loudness to target without the true peak
+// going over ceiling, in dB.
+double loudness_normalize_gain(const Loudness *loudness, double target_lufs, double ceiling_db) {
+    double integrated = loudness_integrated(loudness);
+    if (!isfinite(integrated)) return 0;
+    return fmin(target_lufs - integrated, ceiling_db - loudness_true_peak_db(loudness));
+}
+
+static uint32_t loudness_read_u32(const uint8_t *data) {
+    return data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+// Multiplies the samples of a 32 bit float WAV file in place.
+bool loudness_apply_gain(const char *path, double gain_db) {
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        printf("loudness.c: loudness_apply_gain: Error: could not open %s\n", path);
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0 || info.st_size < 12) {
+        printf("loudness.c: loudness_apply_gain: Error: could not read %s\n", path);
+        close(fd);
+        return false;
+    }
+    size_t size = info.st_size;
+    uint8_t *file = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+        printf("loudness.c: loudness_apply_gain: Error: could not map %s\n", path);
+        return false;
+    }
+
+    bool is_float = false, ok = false;
+    if (memcmp(file, "RIFF", 4) == 0 && memcmp(file + 8, "WAVE", 4) == 0) {
+        size_t offset = 12;
+        while (offset + 8 <= size) {
+            const uint8_t *chunk = file + offset;
+            size_t chunk_size = loudness_read_u32(chunk + 4);
+            size_t available = size - offset - 8;
+            if (chunk_size > available) chunk_size = available; // unfinished header
+
+            if (memcmp(chunk, "fmt ", 4) == 0 && chunk_size >= 16) {
+                uint16_t format = chunk[8] | chunk[9] << 8;
+                uint16_t bits = chunk[22] | chunk[23] << 8;
+                // extensible keeps the real format in the sub format
+                if (format == 0xFFFE && chunk_size >= 40) format = chunk[32] | chunk[33] << 8;
+                is_float = format == 3 && bits == 32;
+            } else if (memcmp(chunk, "data", 4) == 0 && is_float) {
+                f32x4 gain = f32x4_splat(powf(10, gain_db / 20));
+                float *samples = (float *)(chunk + 8);
+                size_t count = chunk_size / sizeof(float);
+                size_t vector_count = count & ~(size_t)3;
+                for (size_t i = 0; i < vector_count; i += 4) f32x4_store(samples + i, f32x4_load(samples + i) * gain);
+                for (size_t i = vector_count; i < count; i++) samples[i] *= gain[0];
+                ok = true;
+                break;
+            }
+            offset += 8 + chunk_size + (chunk_size & 1);
+        }
+    }
+
+    munmap(file, size);
+    if (!ok) printf("loudness.c: loudness_apply_gain: Error: %s is not a 32 bit float WAV file\n", path);
+    return ok;
+}
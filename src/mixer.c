@@ -0,0 +1,176 @@
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "simd.h"
+
+// Mixer puts every track into the stereo output with its gain, pan, mute
+// and solo, and after its gain into the send bus of the effects. The
+// settings belong to the render thread, the audio thread gets them through
+// a single producer, single consumer control queue and ramps the gains to
+// the new values over one block.
+//
+// All settings zero is the song as written, so a zeroed mixer needs no
+// setup. Pan is constant power with unity at the center, hard left or
+// right is +3 dB on that side.
+
+#define MIXER_QUEUE_CAPACITY 64
+#define MIXER_MIN_GAIN_DB -60.0f
+#define MIXER_MAX_GAIN_DB 12.0f
+
+typedef struct {
+    float gain_db;
+    float pan;     // -1 left, 1 right
+    bool is_muted;
+    bool is_solo;
+    float send;    // 0 to 1
+} MixerChannel;
+
+typedef struct {
+    size_t track;
+    MixerChannel channel;
+} MixerCommand;
+
+typedef struct {
+    MixerCommand commands[MIXER_QUEUE_CAPACITY];
+    _Atomic(size_t) write;
+    _Atomic(size_t) read;
+} MixerQueue;
+
+// Owned by the thread that renders.
+typedef struct {
+    MixerChannel channels[SONG_MAX_TRACKS];
+    float target_left[SONG_MAX_TRACKS];  // without the song's gain
+    float target_right[SONG_MAX_TRACKS];
+    float left[SONG_MAX_TRACKS];         // reached at the end of the last block
+    float right[SONG_MAX_TRACKS];
+    float target_send[SONG_MAX_TRACKS];
+    float send[SONG_MAX_TRACKS];
+    bool is_started;
+    Effects effects;
+} Mixer;
+
+// Render thread, false if the queue is full.
+bool mixer_send(MixerQueue *queue, size_t track, MixerChannel channel) {
+    size_t write = atomic_load_explicit(&queue->write, memory_order_relaxed);
+    size_t read = atomic_load_explicit(&queue->read, memory_order_acquire);
+    if (write - read >= MIXER_QUEUE_CAPACITY || track >= SONG_MAX_TRACKS) return false;
+
+    queue->commands[write % MIXER_QUEUE_CAPACITY] = (MixerCommand) { track, channel };
+    atomic_store_explicit(&queue->write, write + 1, memory_order_release);
+    return true;
+}
+
+static void mixer_update_targets(Mixer *mixer) {
+    bool has_solo = false;
+    for (size_t t = 0; t < SONG_MAX_TRACKS; t++) has_solo = has_solo || mixer->channels[t].is_solo;
+
+    for (size_t t = 0; t < SONG_MAX_TRACKS; t++) {
+        const MixerChannel *channel = &mixer->channels[t];
+        bool is_audible = !channel->is_muted && (!has_solo || channel->is_solo);
+
+        // in double so the center comes out as exactly 1
+        double angle = (channel->pan + 1) * M_PI / 4;
+        double gain = is_audible ? pow(10, channel->gain_db / 20) : 0;
+        mixer->target_left[t] = (float)(gain * M_SQRT2 * cos(angle));
+        mixer->target_right[t] = (float)(gain * M_SQRT2 * sin(angle));
+        mixer->target_send[t] = (float)(gain * channel->send);
+    }
+}
+
+// Audio thread, takes the queued settings before a render.
+void mixer_apply(Mixer *mixer, MixerQueue *queue) {
+    size_t read = atomic_load_explicit(&queue->read, memory_order_relaxed);
+    size_t write = atomic_load_explicit(&queue->write, memory_order_acquire);
+    bool is_changed = !mixer->is_started;
+
+    for (; read != write; read++) {
+        const MixerCommand *command = &queue->commands[read % MIXER_QUEUE_CAPACITY];
+        mixer->channels[command->track] = command->channel;
+        is_changed = true;
+    }
+    atomic_store_explicit(&queue->read, read, memory_order_release);
+
+    if (!is_changed) return;
+    mixer_update_targets(mixer);
+    if (!mixer->is_started) {
+        memcpy(mixer->left, mixer->target_left, sizeof(mixer->left));
+        memcpy(mixer->right, mixer->target_right, sizeof(mixer->right));
+        memcpy(mixer->send, mixer->target_send, sizeof(mixer->send));
+        mixer->is_started = true;
+    }
+}
+
+// Adds count samples of a track to the planar stereo buses and the send bus,
+// gains ramp from where the last block ended to the target.
+void mixer_add_track(Mixer *mixer, size_t track, float song_gain, const float *signal,
+                     float *left, float *right, float *send, size_t count) {
+    float start_left = song_gain, start_right = song_gain;
+    float end_left = song_gain, end_right = song_gain;
+    if (mixer != NULL && (mixer->send[track] != 0 || mixer->target_send[track] != 0)) {
+        float start_send = song_gain * mixer->send[track];
+        f32x4 step_send = f32x4_splat((song_gain * mixer->target_send[track] - start_send) / count);
+        for (size_t j = 0; j < count; j += 4) {
+            f32x4 position = f32x4_splat(j + 1) + F32X4_IOTA;
+            f32x4 value = f32x4_load(signal + j);
+            f32x4_store(send + j, f32x4_load(send + j) + value * (f32x4_splat(start_send) + step_send * position));
+        }
+        mixer->send[track] = mixer->target_send[track];
+    }
+    if (mixer != NULL) {
+        start_left *= mixer->left[track];
+        start_right *= mixer->right[track];
+        end_left *= mixer->target_left[track];
+        end_right *= mixer->target_right[track];
+        mixer->left[track] = mixer->target_left[track];
+        mixer->right[track] = mixer->target_right[track];
+    }
+
+    if (start_left == end_left && start_right == end_right) {
+        f32x4 gain_left = f32x4_splat(end_left), gain_right = f32x4_splat(end_right);
+        for (size_t j = 0; j < count; j += 4) {
+            f32x4 value = f32x4_load(signal + j);
+            f32x4_store(left + j, f32x4_load(left + j) + value * gain_left);
+            f32x4_store(right + j, f32x4_load(right + j) + value * gain_right);
+        }
+        return;
+    }
+
+    f32x4 step_left = f32x4_splat((end_left - start_left) / count);
+    f32x4 step_right = f32x4_splat((end_right - start_right) / count);
+    for (size_t j = 0; j < count; j += 4) {
+        f32x4 position = f32x4_splat(j + 1) + F32X4_IOTA;
+        f32x4 value = f32x4_load(signal + j);
+        f32x4_store(left + j, f32x4_load(left + j) + value * (f32x4_splat(start_left) + step_left * position));
+        f32x4_store(right + j, f32x4_load(right + j) + value * (f32x4_splat(start_right) + step_right * position));
+    }
+}
+
+// Interleaves the buses into count frames of output.
+void mixer_interleave(const float *left, const float *right, float *output, size_t count) {
+    size_t vector_count = count & ~(size_t)3;
+    for (size_t j = 0; j < vector_count; j += 4) {
+        f32x4 l = f32x4_load(left + j), r = f32x4_load(right + j);
+        f32x4_store(output + j * 2, f32x4_interleave_low(l, r));
+        f32x4_store(output + j * 2 + 4, f32x4_interleave_high(l, r));
+    }
+    for (size_t j = vector_count; j < count; j++) {
+        output[j * 2 + 0] = left[j];
+        output[j * 2 + 1] = right[j];
+    }
+}
+
+// Renders what the effects still hold once the song is over.
+void mixer_render_tail(Mixer *mixer, float *output, size_t frames_count) {
+    float left[ENGINE_BLOCK_SIZE], right[ENGINE_BLOCK_SIZE];
+    static const float silence[ENGINE_BLOCK_SIZE] = {0};
+
+    for (size_t i = 0; i < frames_count; i += ENGINE_BLOCK_SIZE) {
+        size_t count = frames_count - i < ENGINE_BLOCK_SIZE ? frames_count - i : ENGINE_BLOCK_SIZE;
+        memset(left, 0, sizeof(left));
+        memset(right, 0, sizeof(right));
+        effects_process(&mixer->effects, silence, left, right, count);
+        mixer_interleave(left, right, output + i * NUMBER_OF_CHANNELS, count);
+    }
+}
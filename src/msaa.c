@@ -0,0 +1,102 @@
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "raylib.h"
+#include "rlgl.h"
+
+// Multisampled render target for export. Frames are drawn into a framebuffer
+// with a multisampled color renderbuffer and resolved into the plain export
+// target with a blit before it is read back. rlgl can attach renderbuffers
+// but not create multisampled ones, those few GL calls are loaded through
+// GLFW, which raylib is linked with.
+//
+// MSAA only smooths triangle edges. The scene shader shades whole pixels
+// and does its own analytic antialiasing, so MSAA helps the shapes drawn
+// with raylib: the immediate scene, spectrum bars and waveforms.
+
+#define MSAA_MAX_SAMPLES 8
+
+#define GL_RENDERBUFFER 0x8D41
+#define GL_RGBA8 0x8058
+#define GL_COLOR_BUFFER_BIT 0x00004000
+
+typedef void (*GLFWglproc)(void);
+GLFWglproc glfwGetProcAddress(const char *name);
+
+typedef void (*GenRenderbuffers)(int count, unsigned int *renderbuffers);
+typedef void (*DeleteRenderbuffers)(int count, const unsigned int *renderbuffers);
+typedef void (*BindRenderbuffer)(unsigned int target, unsigned int renderbuffer);
+typedef void (*RenderbufferStorageMultisample)(unsigned int target, int samples, unsigned int format, int width, int height);
+
+typedef struct {
+    GenRenderbuffers gen_renderbuffers;
+    DeleteRenderbuffers delete_renderbuffers;
+    BindRenderbuffer bind_renderbuffer;
+    RenderbufferStorageMultisample renderbuffer_storage_multisample;
+} MsaaFunctions;
+
+typedef struct {
+    RenderTexture2D target; // texture id is 0, only the size is set
+    unsigned int color_buffer;
+    int samples;
+} MsaaTarget;
+
+// Looked up again after every reload, pointers are not kept in State.
+static MsaaFunctions msaa_functions;
+
+static bool msaa_load_functions(void) {
+    MsaaFunctions *gl = &msaa_functions;
+    if (gl->renderbuffer_storage_multisample != NULL) return true;
+
+    gl->gen_renderbuffers = (GenRenderbuffers)glfwGetProcAddress("glGenRenderbuffers");
+    gl->delete_renderbuffers = (DeleteRenderbuffers)glfwGetProcAddress("glDeleteRenderbuffers");
+    gl->bind_renderbuffer = (BindRenderbuffer)glfwGetProcAddress("glBindRenderbuffer");
+    gl->renderbuffer_storage_multisample = (RenderbufferStorageMultisample)glfwGetProcAddress("glRenderbufferStorageMultisample");
+
+    return gl->gen_renderbuffers != NULL && gl->delete_renderbuffers != NULL
+        && gl->bind_renderbuffer != NULL && gl->renderbuffer_storage_multisample != NULL;
+}
+
+void msaa_unload(MsaaTarget *msaa) {
+    if (msaa->target.id != 0) rlUnloadFramebuffer(msaa->target.id);
+    if (msaa->color_buffer != 0 && msaa_load_functions()) msaa_functions.delete_renderbuffers(1, &msaa->color_buffer);
+    *msaa = (MsaaTarget) {0};
+}
+
+// Returns false if the driver can not do that many samples.
+bool msaa_load(MsaaTarget *msaa, int width, int height, int samples) {
+    *msaa = (MsaaTarget) {0};
+    if (samples < 2 || samples > MSAA_MAX_SAMPLES) return false;
+    if (!msaa_load_functions()) {
+        printf("msaa.c: msaa_load: Error: multisampled renderbuffers are not supported\n");
+        return false;
+    }
+
+    MsaaFunctions *gl = &msaa_functions;
+    gl->gen_renderbuffers(1, &msaa->color_buffer);
+    gl->bind_renderbuffer(GL_RENDERBUFFER, msaa->color_buffer);
+    gl->renderbuffer_storage_multisample(GL_RENDERBUFFER, samples, GL_RGBA8, width, height);
+    gl->bind_renderbuffer(GL_RENDERBUFFER, 0);
+
+    msaa->target.id = rlLoadFramebuffer();
+    rlFramebufferAttach(msaa->target.id, msaa->color_buffer, RL_ATTACHMENT_COLOR_CHANNEL0, RL_ATTACHMENT_RENDERBUFFER, 0);
+    msaa->target.texture.width = width;
+    msaa->target.texture.height = height;
+    msaa->samples = samples;
+
+    if (!rlFramebufferComplete(msaa->target.id)) {
+        printf("msaa.c: msaa_load: Error: could not create %dx MSAA target\n", samples);
+        msaa_unload(msaa);
+        return false;
+    }
+    return true;
+}
+
+// Averages the samples into the target, call after EndTextureMode.
+void msaa_resolve(const MsaaTarget *msaa, const RenderTexture2D *resolved) {
+    int width = msaa->target.texture.width, height = msaa->target.texture.height;
+    rlBindFramebuffer(RL_READ_FRAMEBUFFER, msaa->target.id);
+    rlBindFramebuffer(RL_DRAW_FRAMEBUFFER, resolved->id);
+    rlBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT);
+    rlDisableFramebuffer();
+}
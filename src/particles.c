@@ -0,0 +1,385 @@
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "raylib.h"
+#include "rlgl.h"
+#include "simd.h"
+
+// Particle layer on top of the scene. The simulation lives in structure of
+// arrays and is stepped on a worker thread while the render thread finishes
+// the frame: every frame DrawFrame waits for the previous step, uploads the
+// alive particles as instances, draws all of them with one instanced call
+// and requests the next step.
+//
+// Instance buffers rotate between PARTICLE_GPU_BUFFERS so that an upload
+// never writes into a buffer the GPU may still be reading.
+
+#define PARTICLE_CAPACITY (1 << 17)
+#define PARTICLE_GPU_BUFFERS 3
+
+#define PARTICLE_LOCATION_CORNER 0
+#define PARTICLE_LOCATION_INSTANCE 4
+#define PARTICLE_LOCATION_COLOR 5
+
+// per second at full intensity
+#define PARTICLE_DUST_RATE 90000.0f
+#define PARTICLE_RING_RATE 40000.0f
+#define PARTICLE_BURST_PER_PIXEL 400.0f
+
+typedef struct {
+    float x, y, radius, life;
+    Color color;
+} ParticleInstance;
+
+typedef struct {
+    // owned by the worker while a step is running
+    float *x, *y, *vx, *vy, *life, *fade, *radius;
+    Color *color;
+    ParticleInstance *instances;
+    size_t instance_count;
+    size_t emit_cursor;
+    float emit_remainder;
+    float last_circle_radius;
+    uint32_t random;
+
+    // input of the requested step
+    Scene scene;
+    float delta_time;
+    int width, height;
+
+    pthread_mutex_t lock;
+    pthread_cond_t condition;
+    uint64_t requested_steps;
+    uint64_t completed_steps;
+    bool is_worker_running;
+    pthread_t worker;
+
+    Shader shader;
+    int resolution_location;
+    unsigned int corner_buffer;
+    unsigned int vertex_arrays[PARTICLE_GPU_BUFFERS];
+    unsigned int instance_buffers[PARTICLE_GPU_BUFFERS];
+    size_t gpu_frame;
+} Particles;
+
+static const char *particle_vertex_shader =
+    "#version 330\n"
+    "layout(location = 0) in vec2 corner;\n"
+    "layout(location = 4) in vec4 instance; // x, y, radius, life\n"
+    "layout(location = 5) in vec4 instanceColor;\n"
+    "uniform vec2 resolution;\n"
+    "out vec2 local;\n"
+    "out vec4 color;\n"
+    "\n"
+    "void main() {\n"
+    "    local = corner;\n"
+    "    color = vec4(instanceColor.rgb, instanceColor.a * instance.w);\n"
+    "    vec2 position = instance.xy + corner * instance.z;\n"
+    "    gl_Position = vec4(position.x / resolution.x * 2.0 - 1.0, 1.0 - position.y / resolution.y * 2.0, 0.0, 1.0);\n"
+    "}\n";
+
+static const char *particle_fragment_shader =
+    "#version 330\n"
+    "in vec2 local;\n"
+    "in vec4 color;\n"
+    "out vec4 finalColor;\n"
+    "\n"
+    "void main() {\n"
+    "    float edge = 1.0 - smoothstep(0.5, 1.0, length(local));\n"
+    "    finalColor = vec4(color.rgb, color.a * edge);\n"
+    "}\n";
+
+static float particle_random(Particles *particles) {
+    // xorshift32, deterministic so exports look the same every time
+    uint32_t x = particles->random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    particles->random = x;
+    return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+static void particle_emit(Particles *particles, float x, float y, float vx, float vy,
+                          float lifetime, float radius, Color color) {
+    size_t i = particles->emit_cursor;
+    particles->emit_cursor = (i + 1) % PARTICLE_CAPACITY;
+
+    particles->x[i] = x;
+    particles->y[i] = y;
+    particles->vx[i] = vx;
+    particles->vy[i] = vy;
+    particles->life[i] = 1;
+    particles->fade[i] = 1 / lifetime;
+    particles->radius[i] = radius;
+    particles->color[i] = color;
+}
+
+static void particles_emit_scene(Particles *particles, const Scene *scene, float dt, int width, int height) {
+    Vector2 center = scene->circle_center;
+
+    // dust drifting out of the center, denser with a brighter background
+    float brightness = (scene->background.r + scene->background.g + scene->background.b) / (3.0f * 255.0f);
+    float amount = particles->emit_remainder + PARTICLE_DUST_RATE * brightness * dt;
+    size_t count = (size_t)amount;
+    particles->emit_remainder = amount - count;
+
+    Color dust = scene->background;
+    dust.a = 160;
+    for (size_t i = 0; i < count; i++) {
+        float angle = 2 * PI * particle_random(particles);
+        float distance = particle_random(particles) * fmaxf(width, height) * 0.6f;
+        float speed = 20 + 60 * particle_random(particles);
+        particle_emit(particles,
+                      center.x + cosf(angle) * distance, center.y + sinf(angle) * distance,
+                      cosf(angle) * speed, sinf(angle) * speed,
+                      0.6f + particle_random(particles), 1 + 2 * particle_random(particles), dust);
+    }
+
+    // sparks thrown off the ring sector along its direction
+    if (scene->has_ring) {
+        float inner = fminf(scene->ring_inner_radius, scene->ring_outer_radius);
+        float outer = fmaxf(scene->ring_inner_radius, scene->ring_outer_radius);
+        float start = scene->ring_start_angle * DEG2RAD;
+        float sweep = (scene->ring_end_angle - scene->ring_start_angle) * DEG2RAD;
+
+        count = (size_t)(PARTICLE_RING_RATE * dt);
+        for (size_t i = 0; i < count; i++) {
+            float angle = start + sweep * particle_random(particles);
+            float distance = inner + (outer - inner) * particle_random(particles);
+            float speed = 100 + 300 * particle_random(particles);
+            particle_emit(particles,
+                          scene->ring_center.x + cosf(angle) * distance, scene->ring_center.y + sinf(angle) * distance,
+                          -sinf(angle) * speed, cosf(angle) * speed,
+                          0.3f + 0.5f * particle_random(particles), 1.5f, scene->ring_color);
+        }
+    }
+
+    // burst from the edge of the circle when it grows on a beat
+    float growth = scene->circle_radius - particles->last_circle_radius;
+    particles->last_circle_radius = scene->circle_radius;
+    if (growth > 0) {
+        count = (size_t)(PARTICLE_BURST_PER_PIXEL * growth);
+        for (size_t i = 0; i < count; i++) {
+            float angle = 2 * PI * particle_random(particles);
+            float speed = 200 + 600 * particle_random(particles);
+            particle_emit(particles,
+                          center.x + cosf(angle) * scene->circle_radius, center.y + sinf(angle) * scene->circle_radius,
+                          cosf(angle) * speed, sinf(angle) * speed,
+                          0.2f + 0.6f * particle_random(particles), 2, scene->circle_color);
+        }
+    }
+}
+
+static void particles_simulate(Particles *particles, float dt) {
+    f32x4 drag = f32x4_splat(powf(0.2f, dt));
+    f32x4 dts = f32x4_splat(dt);
+    f32x4 zero = f32x4_splat(0);
+
+    for (size_t i = 0; i < PARTICLE_CAPACITY; i += 4) {
+        f32x4 vx = f32x4_load(particles->vx + i) * drag;
+        f32x4 vy = f32x4_load(particles->vy + i) * drag;
+        f32x4 life = f32x4_load(particles->life + i) - f32x4_load(particles->fade + i) * dts;
+        life = (f32x4)((i32x4)life & (life > zero));
+
+        f32x4_store(particles->x + i, f32x4_load(particles->x + i) + vx * dts);
+        f32x4_store(particles->y + i, f32x4_load(particles->y + i) + vy * dts);
+        f32x4_store(particles->vx + i, vx);
+        f32x4_store(particles->vy + i, vy);
+        f32x4_store(particles->life + i, life);
+    }
+
+    // pack alive particles, written unconditionally and kept by count
+    size_t count = 0;
+    for (size_t i = 0; i < PARTICLE_CAPACITY; i++) {
+        particles->instances[count] = (ParticleInstance) {
+            particles->x[i], particles->y[i], particles->radius[i], particles->life[i], particles->color[i]
+        };
+        count += particles->life[i] > 0;
+    }
+    particles->instance_count = count;
+}
+
+static void particles_run_step(Particles *particles) {
+    particles_emit_scene(particles, &particles->scene, particles->delta_time, particles->width, particles->height);
+    particles_simulate(particles, particles->delta_time);
+}
+
+static void *particles_worker(void *argument) {
+    Particles *particles = argument;
+    pthread_mutex_lock(&particles->lock);
+    while (true) {
+        while (particles->is_worker_running && particles->completed_steps == particles->requested_steps) {
+            pthread_cond_wait(&particles->condition, &particles->lock);
+        }
+        if (!particles->is_worker_running) break;
+        pthread_mutex_unlock(&particles->lock);
+
+        particles_run_step(particles);
+
+        pthread_mutex_lock(&particles->lock);
+        particles->completed_steps++;
+        pthread_cond_broadcast(&particles->condition);
+    }
+    pthread_mutex_unlock(&particles->lock);
+    return NULL;
+}
+
+void particles_start_worker(Particles *particles) {
+    pthread_mutex_lock(&particles->lock);
+    particles->is_worker_running = true;
+    pthread_mutex_unlock(&particles->lock);
+
+    if (pthread_create(&particles->worker, NULL, particles_worker, particles) != 0) {
+        printf("particles.c: particles_start_worker: Error: could not create thread\n");
+        particles->is_worker_running = false;
+    }
+}
+
+// Must be called before the plugin is unloaded, the worker runs plugin code.
+void particles_stop_worker(Particles *particles) {
+    pthread_mutex_lock(&particles->lock);
+    bool was_running = particles->is_worker_running;
+    particles->is_worker_running = false;
+    pthread_cond_broadcast(&particles->condition);
+    pthread_mutex_unlock(&particles->lock);
+
+    if (was_running) pthread_join(particles->worker, NULL);
+
+    // finish a step the worker did not get to
+    if (particles->completed_steps != particles->requested_steps) {
+        particles_run_step(particles);
+        particles->completed_steps = particles->requested_steps;
+    }
+}
+
+// Waits for the requested step, after it the simulation belongs to the caller.
+void particles_wait(Particles *particles) {
+    pthread_mutex_lock(&particles->lock);
+    while (particles->is_worker_running && particles->completed_steps != particles->requested_steps) {
+        pthread_cond_wait(&particles->condition, &particles->lock);
+    }
+    pthread_mutex_unlock(&particles->lock);
+}
+
+// Requests a step from the scene of this frame, call particles_wait before.
+// Without the worker the step runs here.
+void particles_step(Particles *particles, const Scene *scene, float delta_time, int width, int height) {
+    pthread_mutex_lock(&particles->lock);
+    particles->scene = *scene;
+    particles->delta_time = delta_time;
+    particles->width = width;
+    particles->height = height;
+    particles->requested_steps++;
+
+    if (particles->is_worker_running) {
+        pthread_cond_broadcast(&particles->condition);
+        pthread_mutex_unlock(&particles->lock);
+    } else {
+        pthread_mutex_unlock(&particles->lock);
+        particles_run_step(particles);
+        particles->completed_steps = particles->requested_steps;
+    }
+}
+
+void particles_load_shader(Particles *particles) {
+    particles->shader = LoadShaderFromMemory(particle_vertex_shader, particle_fragment_shader);
+    particles->resolution_location = GetShaderLocation(particles->shader, "resolution");
+}
+
+void particles_unload_shader(Particles *particles) {
+    UnloadShader(particles->shader);
+    particles->shader = (Shader) {0};
+}
+
+void particles_init(Particles *particles) {
+    float *floats = calloc(7 * PARTICLE_CAPACITY, sizeof(float));
+    Color *colors = calloc(PARTICLE_CAPACITY, sizeof(Color));
+    ParticleInstance *instances = malloc(PARTICLE_CAPACITY * sizeof(ParticleInstance));
+    assert(floats != NULL && colors != NULL && instances != NULL && "Buy MORE RAM lol!!");
+
+    particles->x      = floats + 0 * PARTICLE_CAPACITY;
+    particles->y      = floats + 1 * PARTICLE_CAPACITY;
+    particles->vx     = floats + 2 * PARTICLE_CAPACITY;
+    particles->vy     = floats + 3 * PARTICLE_CAPACITY;
+    particles->life   = floats + 4 * PARTICLE_CAPACITY;
+    particles->fade   = floats + 5 * PARTICLE_CAPACITY;
+    particles->radius = floats + 6 * PARTICLE_CAPACITY;
+    particles->color = colors;
+    particles->instances = instances;
+    particles->random = 0x2545F491;
+
+    pthread_mutex_init(&particles->lock, NULL);
+    pthread_cond_init(&particles->condition, NULL);
+
+    // two triangles covering the particle, instanced once per particle
+    static const float corners[] = { -1, -1,  1, -1,  1, 1,  -1, -1,  1, 1,  -1, 1 };
+    particles->corner_buffer = rlLoadVertexBuffer(corners, sizeof(corners), false);
+
+    for (size_t b = 0; b < PARTICLE_GPU_BUFFERS; b++) {
+        particles->vertex_arrays[b] = rlLoadVertexArray();
+        rlEnableVertexArray(particles->vertex_arrays[b]);
+
+        rlEnableVertexBuffer(particles->corner_buffer);
+        rlSetVertexAttribute(PARTICLE_LOCATION_CORNER, 2, RL_FLOAT, false, 2 * sizeof(float), 0);
+        rlEnableVertexAttribute(PARTICLE_LOCATION_CORNER);
+
+        particles->instance_buffers[b] = rlLoadVertexBuffer(NULL, PARTICLE_CAPACITY * sizeof(ParticleInstance), true);
+        rlSetVertexAttribute(PARTICLE_LOCATION_INSTANCE, 4, RL_FLOAT, false, sizeof(ParticleInstance), 0);
+        rlEnableVertexAttribute(PARTICLE_LOCATION_INSTANCE);
+        rlSetVertexAttributeDivisor(PARTICLE_LOCATION_INSTANCE, 1);
+        rlSetVertexAttribute(PARTICLE_LOCATION_COLOR, 4, RL_UNSIGNED_BYTE, true, sizeof(ParticleInstance),
+                             offsetof(ParticleInstance, color));
+        rlEnableVertexAttribute(PARTICLE_LOCATION_COLOR);
+        rlSetVertexAttributeDivisor(PARTICLE_LOCATION_COLOR, 1);
+
+        rlDisableVertexArray();
+    }
+    rlDisableVertexBuffer();
+
+    particles_load_shader(particles);
+}
+
+void particles_free(Particles *particles) {
+    particles_stop_worker(particles);
+    particles_unload_shader(particles);
+
+    for (size_t b = 0; b < PARTICLE_GPU_BUFFERS; b++) {
+        rlUnloadVertexArray(particles->vertex_arrays[b]);
+        rlUnloadVertexBuffer(particles->instance_buffers[b]);
+    }
+    rlUnloadVertexBuffer(particles->corner_buffer);
+
+    pthread_mutex_destroy(&particles->lock);
+    pthread_cond_destroy(&particles->condition);
+    free(particles->x);
+    free(particles->color);
+    free(particles->instances);
+}
+
+// Draws the last completed step, call particles_wait before.
+void particles_draw(Particles *particles, int width, int height) {
+    size_t count = particles->instance_count;
+    size_t b = particles->gpu_frame++ % PARTICLE_GPU_BUFFERS;
+    if (count == 0) return;
+
+    rlDrawRenderBatchActive();
+    rlUpdateVertexBuffer(particles->instance_buffers[b], particles->instances, count * sizeof(ParticleInstance), 0);
+
+    BeginBlendMode(BLEND_ADDITIVE);
+    rlEnableShader(particles->shader.id);
+    float resolution[2] = { width, height };
+    rlSetUniform(particles->resolution_location, resolution, RL_SHADER_UNIFORM_VEC2, 1);
+
+    rlEnableVertexArray(particles->vertex_arrays[b]);
+    rlDrawVertexArrayInstanced(0, 6, count);
+    rlDisableVertexArray();
+
+    rlDisableShader();
+    EndBlendMode();
+}
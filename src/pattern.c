@@ -0,0 +1,912 @@
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tempo.c"
+#include "voices.c"
+#include "filter.c"
+
+// Song files come in two forms:
+//   song.txt       - text source, edited by hand
+//   build/song.bin - compiled binary, mapped read-only by the engine
+//
+// Binary layout (native endianness):
+//   SongHeader
+//   TrackInfo[track_count]                - voice graph and gain of every track
+//   TempoEvent[tempo_event_count]         - sorted by step
+//   Setting[settings_count][track_count]  - one row of settings per step
+//
+// Rows are stored step-major so that any time range of the song is one
+// contiguous region of the file.
+//
+// Steps are read through a small cache of chunks. A worker thread pages in
+// the chunk each reader is in and the one after it, and evicts the rest, so
+// only a few chunks are resident no matter how long the song is. Songs can
+// also be produced by a generator callback instead of a file.
+
+#define SONG_MAGIC "BEEP"
+#define SONG_VERSION 6
+
+#define SONG_MAX_TRACKS 64
+#define SONG_MAX_VOICES 16 // per polyphonic track
+#define SONG_MAX_REPEAT_DEPTH 8
+#define SONG_MAX_TEMPO_EVENTS 1024
+
+#define STEP_CHUNK_SIZE 256
+#define STEP_CACHE_SLOTS 8
+
+typedef enum {
+    RAMP_NONE,        // value holds for the whole step
+    RAMP_LINEAR,      // value moves to the next step's value over the step
+    RAMP_EXPONENTIAL, // same, with constant ratio per frame, good for pitch
+    RAMP_CURVE,       // same, easing in and out
+} Ramp;
+
+typedef struct {
+    float wave1;
+    float wave2;
+    float wave3;
+    float cutoff; // of the track's filter, Hz
+    uint8_t ramp1;
+    uint8_t ramp2;
+    uint8_t ramp3;
+    uint8_t cutoff_ramp;
+    int8_t chord[3]; // semitones over wave1 of more notes, 0 is none, polyphonic tracks only
+} Setting;
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t track_count;
+    uint32_t settings_count;
+    uint32_t tempo_event_count;
+} SongHeader;
+
+typedef struct {
+    char name[16];
+    float gain;
+    uint32_t voice;         // VoiceKind the graph was built from
+    uint32_t reset_on_loop; // phases restart when the song repeats
+    uint32_t node_count;
+    uint32_t output;
+    Node nodes[GRAPH_MAX_NODES];
+    FilterSettings filter;
+    uint32_t polyphony;     // voices of the track, 0 if it is not polyphonic
+    float release;          // seconds for released voices to ring out
+} TrackInfo;
+
+// Fills count rows of track_count settings starting at first_step.
+// Called on the cache worker thread, steps may be requested in any order.
+typedef void (*StepGenerator)(void *user, size_t first_step, size_t count, size_t track_count, Setting *out);
+
+typedef enum {
+    STEP_READER_AUDIO,
+    STEP_READER_RENDER,
+    STEP_READER_OVERVIEW,
+    STEP_READER_STEMS,
+    STEP_READER_COUNT,
+} StepReader;
+
+typedef struct {
+    _Atomic(int64_t) chunk; // -1 while empty or being filled
+    const Setting *rows;
+    Setting *buffer;        // storage for generated chunks
+} StepSlot;
+
+typedef struct {
+    void *mapping;
+    size_t mapping_size;
+    const Setting *settings;
+
+    StepGenerator generator;
+    void *generator_user;
+
+    size_t track_count;
+    size_t settings_count;
+    size_t chunk_count;
+    const TrackInfo *tracks;
+    TrackInfo *owned_tracks;
+    bool is_fused[SONG_MAX_TRACKS]; // track has the graph of its voice preset, a fused kernel renders it
+    TempoMap tempo;
+
+    StepSlot slots[STEP_CACHE_SLOTS];
+    _Atomic(int64_t) reader_chunk[STEP_READER_COUNT];
+    _Atomic(size_t) misses;
+
+    _Atomic(bool) is_worker_running;
+    pthread_t worker;
+} Song;
+
+// Returns modification time in nanoseconds, 0 if the file does not exist.
+int64_t file_modified_time(const char *path) {
+    struct stat attributes;
+    if (stat(path, &attributes) < 0) return 0;
+#ifdef __APPLE__
+    return (int64_t)attributes.st_mtimespec.tv_sec * 1000000000 + attributes.st_mtimespec.tv_nsec;
+#else
+    return (int64_t)attributes.st_mtim.tv_sec * 1000000000 + attributes.st_mtim.tv_nsec;
+#endif
+}
+
+// COMPILER
+
+typedef struct {
+    Setting *items;
+    size_t count;
+    size_t capacity;
+} SettingList;
+
+typedef struct {
+    const char *path;
+    char *text;
+    char *cursor;
+    int line;
+} Parser;
+
+static void setting_list_push(SettingList *list, Setting setting) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity == 0 ? 256 : list->capacity * 2;
+        list->items = realloc(list->items, list->capacity * sizeof(Setting));
+        assert(list->items != NULL && "Buy MORE RAM lol!!");
+    }
+    list->items[list->count++] = setting;
+}
+
+// Returns next whitespace separated token, NULL at the end of the file.
+static char *parser_next_token(Parser *parser) {
+    for (;;) {
+        while (isspace((unsigned char)*parser->cursor)) {
+            if (*parser->cursor == '\n') parser->line++;
+            parser->cursor++;
+        }
+        if (*parser->cursor != '#') break;
+        while (*parser->cursor != '\0' && *parser->cursor != '\n') parser->cursor++;
+    }
+
+    if (*parser->cursor == '\0') return NULL;
+
+    char *token = parser->cursor;
+    while (*parser->cursor != '\0' && !isspace((unsigned char)*parser->cursor)) parser->cursor++;
+    if (*parser->cursor != '\0') {
+        if (*parser->cursor == '\n') parser->line++;
+        *parser->cursor++ = '\0';
+    }
+    return token;
+}
+
+static bool parse_number(const char *token, float *value) {
+    if (token == NULL) return false;
+    char *end = NULL;
+    *value = strtof(token, &end);
+    return end != token && *end == '\0';
+}
+
+// Integer in min..max, a node of the graph or a parameter.
+static bool parse_index(const char *token, size_t min, size_t max, uint8_t *index) {
+    float value;
+    if (!parse_number(token, &value) || value != floorf(value) || value < min || value > max) return false;
+    *index = (uint8_t)value;
+    return true;
+}
+
+// Node of a graph written in the song, inputs are numbers of its nodes.
+static bool parse_node(Parser *parser, Node *node) {
+    static const char *shapes[] = { [WAVE_SINE] = "sine", [WAVE_TRIANGLE] = "triangle", [WAVE_SQUARE] = "square" };
+    const uint8_t last = GRAPH_MAX_NODES - 1;
+    char *kind = parser_next_token(parser);
+    if (kind == NULL) return false;
+    *node = (Node) {0};
+
+    if (strcmp(kind, "param") == 0) {
+        node->kind = NODE_PARAM;
+        if (!parse_index(parser_next_token(parser), 1, 3, &node->input1)) return false;
+        node->input1--;
+        return true;
+    }
+    for (size_t shape = 0; shape < sizeof(shapes) / sizeof(shapes[0]); shape++) {
+        if (strcmp(kind, shapes[shape]) == 0) {
+            node->kind = NODE_OSCILLATOR;
+            node->shape = shape;
+            return parse_index(parser_next_token(parser), 0, last, &node->input1);
+        }
+    }
+    if (strcmp(kind, "modulator") == 0) {
+        node->kind = NODE_MODULATOR;
+        return parse_index(parser_next_token(parser), 0, last, &node->input1)
+            && parse_number(parser_next_token(parser), &node->scale)
+            && parse_number(parser_next_token(parser), &node->offset);
+    }
+    if (strcmp(kind, "multiply") == 0) {
+        node->kind = NODE_MULTIPLY;
+        return parse_index(parser_next_token(parser), 0, last, &node->input1)
+            && parse_index(parser_next_token(parser), 0, last, &node->input2);
+    }
+    return false;
+}
+
+// Chord of a step: a note and semitones over it, like 200+4+7.
+static bool parse_chord(char *token, float *value, int8_t *chord) {
+    char *plus = strchr(token, '+');
+    if (plus == NULL) return false;
+
+    *plus = '\0';
+    bool result = parse_number(token, value);
+    *plus = '+';
+
+    size_t count = 0;
+    while (result && plus != NULL) {
+        char *end = NULL;
+        long semitones = strtol(plus + 1, &end, 10);
+        result = end != plus + 1 && (*end == '\0' || *end == '+')
+            && semitones > 0 && semitones <= 48 && count < 3;
+        if (result) chord[count++] = (int8_t)semitones;
+        plus = *end == '+' ? end : NULL;
+    }
+    return result;
+}
+
+// Step value, optionally followed by a ramp into the next step.
+static bool parse_step_value(char *token, float *value, uint8_t *ramp) {
+    size_t length = strlen(token);
+    char suffix = length > 1 ? token[length - 1] : '\0';
+
+    switch (suffix) {
+    case '/': *ramp = RAMP_LINEAR;      break;
+    case '^': *ramp = RAMP_EXPONENTIAL; break;
+    case '~': *ramp = RAMP_CURVE;       break;
+    default:  *ramp = RAMP_NONE;        break;
+    }
+    if (*ramp == RAMP_NONE) return parse_number(token, value);
+
+    token[length - 1] = '\0';
+    bool result = parse_number(token, value);
+    token[length - 1] = suffix;
+    return result;
+}
+
+static char *read_entire_file(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *text = malloc(size + 1);
+    assert(text != NULL && "Buy MORE RAM lol!!");
+    size_t read = fread(text, 1, size, file);
+    text[read] = '\0';
+    fclose(file);
+    return text;
+}
+
+static bool song_set_voice(TrackInfo *info, VoiceKind kind) {
+    const VoicePreset *preset = &voice_presets[kind];
+    size_t output;
+    if (!voice_sort(preset->nodes, preset->node_count, preset->output, info->nodes, &output)) return false;
+    info->voice = kind;
+    info->reset_on_loop = preset->reset_on_loop;
+    info->node_count = preset->node_count;
+    info->output = output;
+    return true;
+}
+
+// Text format:
+//   # comment
+//   track <name>           starts a new track
+//   voice <preset>         voice of the current track: bass, beeps or beat
+//   node <kind> ...        adds a node to the graph of the current track, which
+//                          replaces the graph of its voice. Nodes are numbered
+//                          from 0 in order, node 0 is the output:
+//                            param <1..3>                 wave1..wave3 of the step
+//                            sine|triangle|square <node>  oscillator at node Hz
+//                            modulator <node> <scale> <offset>
+//                            multiply <node> <node>
+//   gain <value>           mix gain of the current track
+//   repeat <n> ... end     repeats enclosed steps n times, may be nested
+//   <wave1> <wave2> <wave3> one step, a value may end with a ramp into the next
+//                          step: / linear, ^ exponential, ~ curve
+//   poly <voices> <release> the current track plays chords on up to 16 voices,
+//                          a note rings out for release seconds after it ends
+//   <wave1>+<n>...         wave1 of a step on a poly track may add up to 3 notes
+//                          n semitones over it, like 200+4+7, it does not ramp
+//   filter <kind> <cutoff> <q> [gain]
+//                          filter of the current track: lowpass, highpass,
+//                          bandpass or peak, gain in dB only for peak
+//   cutoff <value>         filter cutoff of the following steps, may end with
+//                          a ramp like a step value
+//   tempo <step> <bpm>     tempo from the step on, default is 75 bpm
+//   ramp <step> <bpm>      ramp linearly from the previous tempo to reach bpm at the step
+//   swing <step> <amount>  swing from the step on, 0 is straight
+//
+// All tracks must have the same number of steps.
+bool song_compile(const char *source_path, const char *binary_path) {
+    bool result = false;
+    SettingList tracks[SONG_MAX_TRACKS] = {0};
+    TrackInfo track_infos[SONG_MAX_TRACKS] = {0};
+    size_t track_count = 0;
+
+    size_t repeat_start[SONG_MAX_REPEAT_DEPTH];
+    size_t repeat_times[SONG_MAX_REPEAT_DEPTH];
+    size_t repeat_depth = 0;
+
+    float values[3];
+    uint8_t ramps[3];
+    size_t values_count = 0;
+    float cutoff = 0;
+    uint8_t cutoff_ramp = RAMP_NONE;
+    int8_t chord[3] = {0};
+
+    TempoEvent tempo_events[SONG_MAX_TEMPO_EVENTS];
+    size_t tempo_event_count = 0;
+
+    Node graphs[SONG_MAX_TRACKS][GRAPH_MAX_NODES];
+    size_t graph_counts[SONG_MAX_TRACKS] = {0};
+
+    Parser parser = { .path = source_path, .line = 1 };
+    parser.text = read_entire_file(source_path);
+    if (parser.text == NULL) {
+        printf("pattern.c: song_compile %s: Error: %s\n", source_path, strerror(errno));
+        return false;
+    }
+    parser.cursor = parser.text;
+
+    char *token;
+    while ((token = parser_next_token(&parser)) != NULL) {
+        SettingList *track = track_count > 0 ? &tracks[track_count - 1] : NULL;
+        float value;
+
+        bool is_step = parse_step_value(token, &values[values_count], &ramps[values_count]);
+        bool is_chord = !is_step && values_count == 0 && parse_chord(token, &values[0], chord);
+        if (is_chord) ramps[0] = RAMP_NONE;
+        if (is_step || is_chord) {
+            if (track == NULL) {
+                printf("%s:%d: Error: step before the first track\n", parser.path, parser.line);
+                goto defer;
+            }
+            if (is_chord && track_infos[track_count - 1].polyphony < 2) {
+                printf("%s:%d: Error: chord on a track with less than 2 voices\n", parser.path, parser.line);
+                goto defer;
+            }
+            values_count++;
+            if (values_count == 3) {
+                setting_list_push(track, (Setting) {
+                    .wave1 = values[0], .wave2 = values[1], .wave3 = values[2], .cutoff = cutoff,
+                    .ramp1 = ramps[0], .ramp2 = ramps[1], .ramp3 = ramps[2], .cutoff_ramp = cutoff_ramp,
+                    .chord = { chord[0], chord[1], chord[2] },
+                });
+                values_count = 0;
+                memset(chord, 0, sizeof(chord));
+            }
+            continue;
+        }
+
+        if (values_count != 0) {
+            printf("%s:%d: Error: incomplete step before '%s'\n", parser.path, parser.line, token);
+            goto defer;
+        }
+
+        if (strcmp(token, "track") == 0) {
+            if (repeat_depth != 0) {
+                printf("%s:%d: Error: track inside of repeat\n", parser.path, parser.line);
+                goto defer;
+            }
+            if (track_count == SONG_MAX_TRACKS) {
+                printf("%s:%d: Error: too many tracks, max %d\n", parser.path, parser.line, SONG_MAX_TRACKS);
+                goto defer;
+            }
+            char *name = parser_next_token(&parser);
+            if (name == NULL) {
+                printf("%s:%d: Error: expected track name\n", parser.path, parser.line);
+                goto defer;
+            }
+            TrackInfo *info = &track_infos[track_count++];
+            strncpy(info->name, name, sizeof(info->name) - 1);
+            info->gain = 1.0f;
+            cutoff = 0;
+            cutoff_ramp = RAMP_NONE;
+            if (!song_set_voice(info, VOICE_BASS)) goto defer;
+        } else if (strcmp(token, "voice") == 0) {
+            char *name = parser_next_token(&parser);
+            VoiceKind kind;
+            if (track == NULL || name == NULL || voice_find(name, &kind) == NULL) {
+                printf("%s:%d: Error: expected voice preset inside of a track\n", parser.path, parser.line);
+                goto defer;
+            }
+            if (!song_set_voice(&track_infos[track_count - 1], kind)) {
+                printf("%s:%d: Error: voice %s is not a valid graph\n", parser.path, parser.line, name);
+                goto defer;
+            }
+        } else if (strcmp(token, "node") == 0) {
+            size_t t = track_count - 1;
+            if (track == NULL || graph_counts[t] == GRAPH_MAX_NODES
+                || !parse_node(&parser, &graphs[t][graph_counts[t]])) {
+                printf("%s:%d: Error: expected node param <1..3>, sine|triangle|square <node>, "
+                       "modulator <node> <scale> <offset> or multiply <node> <node> inside of a track, max %d nodes\n",
+                       parser.path, parser.line, GRAPH_MAX_NODES);
+                goto defer;
+            }
+            graph_counts[t]++;
+        } else if (strcmp(token, "gain") == 0) {
+            char *gain = parser_next_token(&parser);
+            if (track == NULL || gain == NULL || !parse_number(gain, &track_infos[track_count - 1].gain)) {
+                printf("%s:%d: Error: expected gain value inside of a track\n", parser.path, parser.line);
+                goto defer;
+            }
+        } else if (strcmp(token, "filter") == 0) {
+            char *name = parser_next_token(&parser);
+            char *frequency = name != NULL ? parser_next_token(&parser) : NULL;
+            char *q = frequency != NULL ? parser_next_token(&parser) : NULL;
+            FilterKind kind;
+            FilterSettings *filter = track != NULL ? &track_infos[track_count - 1].filter : NULL;
+            if (filter == NULL || q == NULL || !filter_find(name, &kind)
+                || !parse_number(frequency, &cutoff) || !parse_number(q, &filter->q) || filter->q <= 0) {
+                printf("%s:%d: Error: expected filter <kind> <cutoff> <q> inside of a track\n", parser.path, parser.line);
+                goto defer;
+            }
+            filter->kind = kind;
+            cutoff_ramp = RAMP_NONE;
+            if (kind == FILTER_PEAK) {
+                char *gain = parser_next_token(&parser);
+                if (gain == NULL || !parse_number(gain, &filter->gain_db)) {
+                    printf("%s:%d: Error: expected gain of the peak filter\n", parser.path, parser.line);
+                    goto defer;
+                }
+            }
+        } else if (strcmp(token, "poly") == 0) {
+            char *voices = parser_next_token(&parser);
+            char *release = voices != NULL ? parser_next_token(&parser) : NULL;
+            TrackInfo *info = track != NULL ? &track_infos[track_count - 1] : NULL;
+            if (info == NULL || release == NULL || !parse_number(voices, &value)
+                || !parse_number(release, &info->release) || info->release < 0) {
+                printf("%s:%d: Error: expected poly <voices> <release> inside of a track\n", parser.path, parser.line);
+                goto defer;
+            }
+            if (value < 1 || value > SONG_MAX_VOICES) {
+                printf("%s:%d: Error: poly voices out of range, max %d\n", parser.path, parser.line, SONG_MAX_VOICES);
+                goto defer;
+            }
+            info->polyphony = (uint32_t)value;
+        } else if (strcmp(token, "cutoff") == 0) {
+            char *frequency = parser_next_token(&parser);
+            if (track == NULL || frequency == NULL || !parse_step_value(frequency, &cutoff, &cutoff_ramp)) {
+                printf("%s:%d: Error: expected cutoff value inside of a track\n", parser.path, parser.line);
+                goto defer;
+            }
+        } else if (strcmp(token, "repeat") == 0) {
+            char *times = parser_next_token(&parser);
+            if (track == NULL || times == NULL || !parse_number(times, &value) || value < 1) {
+                printf("%s:%d: Error: expected repeat count inside of a track\n", parser.path, parser.line);
+                goto defer;
+            }
+            if (repeat_depth == SONG_MAX_REPEAT_DEPTH) {
+                printf("%s:%d: Error: repeat nested too deep\n", parser.path, parser.line);
+                goto defer;
+            }
+            repeat_start[repeat_depth] = track->count;
+            repeat_times[repeat_depth] = (size_t)value;
+            repeat_depth++;
+        } else if (strcmp(token, "tempo") == 0 || strcmp(token, "ramp") == 0 || strcmp(token, "swing") == 0) {
+            TempoEvent event = {0};
+            event.kind = token[0] == 't' ? TEMPO_SET : token[0] == 'r' ? TEMPO_RAMP : TEMPO_SWING;
+
+            char *step = parser_next_token(&parser);
+            char *amount = step != NULL ? parser_next_token(&parser) : NULL;
+            if (step == NULL || amount == NULL || !parse_number(step, &value) || value < 0
+                || !parse_number(amount, &event.value)) {
+                printf("%s:%d: Error: expected %s <step> <value>\n", parser.path, parser.line, token);
+                goto defer;
+            }
+            event.step = (uint32_t)value;
+
+            if (!tempo_event_is_valid(&event)) {
+                printf("%s:%d: Error: %s value out of range, bpm is %d..%d and swing 0..1\n",
+                       parser.path, parser.line, token, TEMPO_MIN_BPM, TEMPO_MAX_BPM);
+                goto defer;
+            }
+            if (tempo_event_count == SONG_MAX_TEMPO_EVENTS) {
+                printf("%s:%d: Error: too many tempo events, max %d\n", parser.path, parser.line, SONG_MAX_TEMPO_EVENTS);
+                goto defer;
+            }
+            tempo_events[tempo_event_count++] = event;
+        } else if (strcmp(token, "end") == 0) {
+            if (repeat_depth == 0) {
+                printf("%s:%d: Error: end without repeat\n", parser.path, parser.line);
+                goto defer;
+            }
+            repeat_depth--;
+            size_t start = repeat_start[repeat_depth];
+            size_t length = track->count - start;
+            for (size_t i = 1; i < repeat_times[repeat_depth]; i++) {
+                for (size_t j = 0; j < length; j++) {
+                    setting_list_push(track, track->items[start + j]);
+                }
+            }
+        } else {
+            printf("%s:%d: Error: unknown word '%s'\n", parser.path, parser.line, token);
+            goto defer;
+        }
+    }
+
+    if (values_count != 0 || repeat_depth != 0) {
+        printf("%s:%d: Error: unexpected end of file\n", parser.path, parser.line);
+        goto defer;
+    }
+    for (size_t t = 0; t < track_count; t++) {
+        if (graph_counts[t] == 0) continue;
+        TrackInfo *info = &track_infos[t];
+        size_t output;
+        memset(info->nodes, 0, sizeof(info->nodes));
+        if (!voice_sort(graphs[t], graph_counts[t], 0, info->nodes, &output)) {
+            printf("%s: Error: nodes of track %zu loop or read a node that is not there\n", parser.path, t + 1);
+            goto defer;
+        }
+        info->node_count = graph_counts[t];
+        info->output = output;
+    }
+    if (track_count == 0 || tracks[0].count == 0) {
+        printf("%s: Error: song has no steps\n", parser.path);
+        goto defer;
+    }
+    for (size_t t = 1; t < track_count; t++) {
+        if (tracks[t].count != tracks[0].count) {
+            printf("%s: Error: track %zu has %zu steps, expected %zu\n",
+                parser.path, t + 1, tracks[t].count, tracks[0].count);
+            goto defer;
+        }
+    }
+
+    { // write to a temporary file and rename, so the engine never maps a half-written song
+        char temporary_path[512];
+        snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", binary_path);
+
+        FILE *file = fopen(temporary_path, "wb");
+        if (file == NULL) {
+            printf("pattern.c: song_compile %s: Error: %s\n", temporary_path, strerror(errno));
+            goto defer;
+        }
+
+        tempo_sort_events(tempo_events, tempo_event_count);
+
+        SongHeader header = {
+            .magic = SONG_MAGIC,
+            .version = SONG_VERSION,
+            .track_count = track_count,
+            .settings_count = tracks[0].count,
+            .tempo_event_count = tempo_event_count,
+        };
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        ok = ok && fwrite(track_infos, sizeof(TrackInfo), track_count, file) == track_count;
+        ok = ok && fwrite(tempo_events, sizeof(TempoEvent), tempo_event_count, file) == tempo_event_count;
+        for (size_t i = 0; ok && i < header.settings_count; i++) {
+            for (size_t t = 0; ok && t < track_count; t++) {
+                ok = fwrite(&tracks[t].items[i], sizeof(Setting), 1, file) == 1;
+            }
+        }
+        ok = fclose(file) == 0 && ok;
+
+        if (!ok || rename(temporary_path, binary_path) < 0) {
+            printf("pattern.c: song_compile %s: Error: %s\n", binary_path, strerror(errno));
+            unlink(temporary_path);
+            goto defer;
+        }
+    }
+
+    result = true;
+
+defer:
+    for (size_t t = 0; t < SONG_MAX_TRACKS; t++) free(tracks[t].items);
+    free(parser.text);
+    return result;
+}
+
+// STEP CACHE
+
+static bool step_chunk_is_needed(Song *song, int64_t chunk) {
+    for (size_t r = 0; r < STEP_READER_COUNT; r++) {
+        int64_t current = atomic_load(&song->reader_chunk[r]);
+        if (current < 0) continue;
+        if (chunk == current || chunk == (current + 1) % (int64_t)song->chunk_count) return true;
+    }
+    return false;
+}
+
+static void step_chunk_range(Song *song, int64_t chunk, size_t *first_step, size_t *count) {
+    *first_step = chunk * STEP_CHUNK_SIZE;
+    *count = song->settings_count - *first_step;
+    if (*count > STEP_CHUNK_SIZE) *count = STEP_CHUNK_SIZE;
+}
+
+static void step_chunk_madvise(Song *song, int64_t chunk, int advice) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t first_step, count;
+    step_chunk_range(song, chunk, &first_step, &count);
+
+    uintptr_t start = (uintptr_t)(song->settings + first_step * song->track_count);
+    uintptr_t end = start + count * song->track_count * sizeof(Setting);
+
+    // only whole pages that belong to this chunk
+    if (advice == MADV_DONTNEED) {
+        start = (start + page_size - 1) & ~(page_size - 1);
+        end = end & ~(page_size - 1);
+    } else {
+        start = start & ~(page_size - 1);
+    }
+    if (start < end) madvise((void *)start, end - start, advice);
+}
+
+// Loads the chunk into a slot taken out of the cache, evicted is its old chunk.
+static void step_chunk_fill(Song *song, StepSlot *victim, int64_t chunk, int64_t evicted) {
+    size_t first_step, count;
+    step_chunk_range(song, chunk, &first_step, &count);
+
+    if (song->generator != NULL) {
+        song->generator(song->generator_user, first_step, count, song->track_count, victim->buffer);
+        victim->rows = victim->buffer;
+    } else {
+        if (evicted >= 0 && song->chunk_count > STEP_CACHE_SLOTS) {
+            step_chunk_madvise(song, evicted, MADV_DONTNEED);
+        }
+        step_chunk_madvise(song, chunk, MADV_WILLNEED);
+
+        // touch every page so readers never fault
+        const volatile char *bytes = (const volatile char *)(song->settings + first_step * song->track_count);
+        size_t size = count * song->track_count * sizeof(Setting);
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        for (size_t offset = 0; offset < size; offset += page_size) (void)bytes[offset];
+        (void)bytes[size - 1];
+
+        victim->rows = song->settings + first_step * song->track_count;
+    }
+
+    atomic_store(&victim->chunk, chunk);
+}
+
+static void step_chunk_load(Song *song, int64_t chunk) {
+    for (size_t i = 0; i < STEP_CACHE_SLOTS; i++) {
+        if (atomic_load(&song->slots[i].chunk) == chunk) return;
+    }
+
+    // Readers publish their chunk before they look for its slot, and a slot
+    // is taken out before the readers are checked again. Either a reader
+    // misses the slot, or the slot is put back for it.
+    for (size_t i = 0; i < STEP_CACHE_SLOTS; i++) {
+        StepSlot *slot = &song->slots[i];
+        int64_t held = atomic_load(&slot->chunk);
+        if (held >= 0 && step_chunk_is_needed(song, held)) continue;
+
+        int64_t evicted = atomic_exchange(&slot->chunk, -1);
+        if (evicted >= 0 && step_chunk_is_needed(song, evicted)) {
+            atomic_store(&slot->chunk, evicted);
+            continue;
+        }
+        step_chunk_fill(song, slot, chunk, evicted);
+        return;
+    }
+}
+
+static void *step_cache_worker(void *argument) {
+    Song *song = argument;
+    while (atomic_load(&song->is_worker_running)) {
+        for (size_t r = 0; r < STEP_READER_COUNT; r++) {
+            int64_t current = atomic_load(&song->reader_chunk[r]);
+            if (current < 0) continue;
+            step_chunk_load(song, current);
+            step_chunk_load(song, (current + 1) % (int64_t)song->chunk_count);
+        }
+        usleep(1000);
+    }
+    return NULL;
+}
+
+void song_start_worker(Song *song) {
+    if (song == NULL || atomic_load(&song->is_worker_running)) return;
+    atomic_store(&song->is_worker_running, true);
+    if (pthread_create(&song->worker, NULL, step_cache_worker, song) != 0) {
+        printf("pattern.c: song_start_worker: Error: could not create thread\n");
+        atomic_store(&song->is_worker_running, false);
+    }
+}
+
+// Must be called before the plugin is unloaded, the worker runs plugin code.
+void song_stop_worker(Song *song) {
+    if (song == NULL || !atomic_load(&song->is_worker_running)) return;
+    atomic_store(&song->is_worker_running, false);
+    pthread_join(song->worker, NULL);
+}
+
+// Same as song_row, without moving the reader. Used to look one step ahead,
+// the chunk after the current one is always prefetched.
+const Setting *song_row_peek(Song *song, size_t position) {
+    int64_t chunk = position / STEP_CHUNK_SIZE;
+    size_t offset = (position % STEP_CHUNK_SIZE) * song->track_count;
+    for (size_t i = 0; i < STEP_CACHE_SLOTS; i++) {
+        if (atomic_load(&song->slots[i].chunk) == chunk) return song->slots[i].rows + offset;
+    }
+    return NULL;
+}
+
+// Returns row of track_count settings for the step, NULL if its chunk is not
+// resident yet. With wait the caller blocks until the chunk is paged in,
+// which is only acceptable off the audio thread.
+const Setting *song_row(Song *song, StepReader reader, size_t position, bool wait) {
+    atomic_store(&song->reader_chunk[reader], position / STEP_CHUNK_SIZE);
+
+    for (;;) {
+        const Setting *row = song_row_peek(song, position);
+        if (row != NULL) return row;
+        if (!wait) break;
+        usleep(100);
+    }
+
+    atomic_fetch_add(&song->misses, 1);
+    return NULL;
+}
+
+static Song *song_create(size_t track_count, size_t settings_count,
+                         const TempoEvent *tempo_events, size_t tempo_event_count, size_t sample_rate) {
+    Song *song = malloc(sizeof(Song));
+    assert(song != NULL && "Buy MORE RAM lol!!");
+    memset(song, 0, sizeof(Song));
+
+    song->track_count = track_count;
+    song->settings_count = settings_count;
+    song->chunk_count = (settings_count + STEP_CHUNK_SIZE - 1) / STEP_CHUNK_SIZE;
+    tempo_map_build(&song->tempo, tempo_events, tempo_event_count, settings_count, sample_rate);
+    for (size_t i = 0; i < STEP_CACHE_SLOTS; i++) atomic_store(&song->slots[i].chunk, -1);
+    for (size_t r = 0; r < STEP_READER_COUNT; r++) atomic_store(&song->reader_chunk[r], 0);
+    return song;
+}
+
+// LOADER
+
+TrackInfo song_track_info(const char *name, VoiceKind voice, float gain) {
+    TrackInfo info = {0};
+    strncpy(info.name, name, sizeof(info.name) - 1);
+    info.gain = gain;
+    bool ok = song_set_voice(&info, voice);
+    assert(ok && "Invalid voice preset");
+    (void)ok;
+    return info;
+}
+
+// The fused kernels find their oscillators by the preset's graph, any other
+// graph is rendered node by node.
+static void song_find_fused(Song *song) {
+    for (size_t t = 0; t < song->track_count; t++) {
+        const TrackInfo *track = &song->tracks[t];
+        TrackInfo preset = {0};
+        song->is_fused[t] = song_set_voice(&preset, track->voice)
+            && track->node_count == preset.node_count && track->output == preset.output
+            && memcmp(track->nodes, preset.nodes, preset.node_count * sizeof(Node)) == 0;
+    }
+}
+
+Song *song_generate(StepGenerator generator, void *user, const TrackInfo *tracks, size_t track_count,
+                    size_t settings_count, size_t sample_rate) {
+    Song *song = song_create(track_count, settings_count, NULL, 0, sample_rate);
+    song->owned_tracks = malloc(track_count * sizeof(TrackInfo));
+    assert(song->owned_tracks != NULL && "Buy MORE RAM lol!!");
+    memcpy(song->owned_tracks, tracks, track_count * sizeof(TrackInfo));
+    song->tracks = song->owned_tracks;
+    song_find_fused(song);
+    song->generator = generator;
+    song->generator_user = user;
+    for (size_t i = 0; i < STEP_CACHE_SLOTS; i++) {
+        song->slots[i].buffer = malloc(STEP_CHUNK_SIZE * track_count * sizeof(Setting));
+        assert(song->slots[i].buffer != NULL && "Buy MORE RAM lol!!");
+    }
+    song_start_worker(song);
+    return song;
+}
+
+// Graphs are executed without checks, every input must come before its node.
+static bool song_tracks_are_valid(const TrackInfo *tracks, size_t track_count) {
+    for (size_t t = 0; t < track_count; t++) {
+        const TrackInfo *track = &tracks[t];
+        if (track->node_count == 0 || track->node_count > GRAPH_MAX_NODES) return false;
+        if (track->output >= track->node_count || track->voice >= VOICE_COUNT) return false;
+        if (track->polyphony > SONG_MAX_VOICES) return false;
+
+        for (size_t n = 0; n < track->node_count; n++) {
+            const Node *node = &track->nodes[n];
+            size_t inputs = node_input_count(node);
+            if (node->kind == NODE_PARAM && node->input1 > 2) return false;
+            if (inputs >= 1 && node->input1 >= n) return false;
+            if (inputs >= 2 && node->input2 >= n) return false;
+        }
+    }
+    return true;
+}
+
+// Same checks as the compiler, the events have to be sorted by step.
+static bool song_tempo_events_are_valid(const TempoEvent *events, size_t event_count) {
+    if (event_count > SONG_MAX_TEMPO_EVENTS) return false;
+    for (size_t i = 0; i < event_count; i++) {
+        if (!tempo_event_is_valid(&events[i])) return false;
+        if (i > 0 && tempo_event_compare(&events[i - 1], &events[i]) > 0) return false;
+    }
+    return true;
+}
+
+void song_unmap(Song *song) {
+    if (song == NULL) return;
+    song_stop_worker(song);
+    if (song->mapping != NULL) munmap(song->mapping, song->mapping_size);
+    tempo_map_free(&song->tempo);
+    free(song->owned_tracks);
+    for (size_t i = 0; i < STEP_CACHE_SLOTS; i++) free(song->slots[i].buffer);
+    free(song);
+}
+
+Song *song_map(const char *binary_path, size_t sample_rate) {
+    int fd = open(binary_path, O_RDONLY);
+    if (fd < 0) {
+        printf("pattern.c: song_map %s: Error: %s\n", binary_path, strerror(errno));
+        return NULL;
+    }
+
+    struct stat attributes;
+    if (fstat(fd, &attributes) < 0 || (size_t)attributes.st_size < sizeof(SongHeader)) {
+        printf("pattern.c: song_map %s: Error: file is too small\n", binary_path);
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = attributes.st_size;
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        printf("pattern.c: song_map %s: Error: %s\n", binary_path, strerror(errno));
+        return NULL;
+    }
+
+    const SongHeader *header = mapping;
+    size_t expected_size = sizeof(SongHeader)
+        + (size_t)header->track_count * sizeof(TrackInfo)
+        + (size_t)header->tempo_event_count * sizeof(TempoEvent)
+        + (size_t)header->settings_count * header->track_count * sizeof(Setting);
+
+    if (memcmp(header->magic, SONG_MAGIC, 4) != 0 || header->version != SONG_VERSION
+        || header->track_count == 0 || header->track_count > SONG_MAX_TRACKS
+        || header->settings_count == 0 || expected_size != size
+        || !song_tracks_are_valid((const TrackInfo *)(header + 1), header->track_count)
+        || !song_tempo_events_are_valid((const TempoEvent *)((const TrackInfo *)(header + 1) + header->track_count),
+                                        header->tempo_event_count)) {
+        printf("pattern.c: song_map %s: Error: not a valid song file\n", binary_path);
+        munmap(mapping, size);
+        return NULL;
+    }
+
+    const TrackInfo *tracks = (const TrackInfo *)(header + 1);
+    const TempoEvent *tempo_events = (const TempoEvent *)(tracks + header->track_count);
+    Song *song = song_create(header->track_count, header->settings_count,
+                             tempo_events, header->tempo_event_count, sample_rate);
+    song->mapping = mapping;
+    song->mapping_size = size;
+    song->settings = (const Setting *)(tempo_events + header->tempo_event_count);
+    song->tracks = tracks;
+    song_find_fused(song);
+
+    if (!tempo_map_is_valid(&song->tempo)) {
+        printf("pattern.c: song_map %s: Error: tempo makes steps shorter than a frame\n", binary_path);
+        song_unmap(song);
+        return NULL;
+    }
+    song_start_worker(song);
+    return song;
+}
+
@@ -1,3 +1,4 @@
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,15 +10,51 @@
 #include "miniaudio.h"
 
 #define NUMBER_OF_CHANNELS 2
-#define SAMPLE_RATE 44100
-
-#define FRAMES_PER_SETTING (SAMPLE_RATE / 5)
+#define AUDIO_DEFAULT_SAMPLE_RATE 48000 // without a device
+#define AUDIO_MAX_SAMPLE_RATE 192000
 
 #define VIDEO_WIDTH 1280
 #define VIDEO_HEIGHT 720
 #define VIDEO_FPS 60
-
-// TODO: add lerp to settings
+#define VIDEO_DISPLAY_DELAY 1 // video frames, a drawn frame is shown at the next vblank
+
+#define LIMITER_CEILING_DB -1.0f
+#define LIMITER_LOOKAHEAD_MS 5.0f
+#define LIMITER_RELEASE_MS 80.0f
+#define LOUDNESS_TARGET_LUFS -14.0
+#define EFFECTS_DEFAULT_SEND 0.2f
+#define EFFECTS_MAX_TAIL_SECONDS 10
+#define EXPORT_OVERSAMPLING 2 // the decimator halves the rate
+#define AUDIO_BUFFER_FRAMES (AUDIO_MAX_SAMPLE_RATE / VIDEO_FPS)
+
+#include "pattern.c"
+#include "automation.c"
+#include "polyphony.c"
+#include "graph.c"
+#include "tap.c"
+#include "effects.c"
+#include "mixer.c"
+#include "limiter.c"
+#include "loudness.c"
+#include "resample.c"
+#include "engine.c"
+#include "spectrum.c"
+#include "batch.c"
+#include "visuals.c"
+#include "particles.c"
+#include "spectrogram.c"
+#include "waveform.c"
+#include "stems.c"
+#include "preview.c"
+#include "msaa.c"
+#include "hud.c"
+#include "trace.c"
+
+#define SONG_SOURCE_PATH "song.txt"
+#define SONG_BINARY_PATH "build/song.bin"
+
+// one hour of generated steps
+#define GENERATED_SONG_SETTINGS (60 * TEMPO_DEFAULT_BPM * TEMPO_STEPS_PER_BEAT)
 
 typedef struct {
     size_t element_id;
@@ -25,23 +62,6 @@ typedef struct {
     Vector2 initial_mouse_position;
 } DraggingState;
 
-typedef struct {
-    float wave1;
-    float wave2;
-    float wave3;
-} Setting;
-
-typedef struct {
-    float wave1;
-    float wave2;
-    float wave3;
-} Phases;
-
-typedef struct {
-    Setting *settings;
-    Phases phases;
-} Track;
-
 typedef struct {
     float track1_circle_position;
 
@@ -58,138 +78,266 @@ typedef struct {
     float track3_circle_color_value;
 } UI;
 
+static const size_t export_sample_rates[] = { 0, 44100, 48000, 96000 }; // 0 is the device's
+
 typedef struct {
     ma_device audio_device;
-
-    Track track1;
-    Track track2;
-    Track track3;
-    size_t settings_count;
+    size_t sample_rate;  // of the output, the device's or the export's
+    size_t oversampling; // the engine and the song run this many times faster
+    size_t device_sample_rate;
+    size_t export_rate_index;
+    bool oversample_export;
+    Decimator decimator;
+
+    TrackState tracks[SONG_MAX_TRACKS];
+
+    // song is swapped by the main thread while the audio thread reads it,
+    // song_hazard holds the song currently used by the audio thread
+    _Atomic(Song *) song;
+    _Atomic(Song *) song_hazard;
+    int64_t song_source_time;
+    int64_t song_binary_time;
+    bool is_song_generated;
+
+    Mixer mixer; // audio thread
+    MixerQueue mixer_queue;
+    MixerChannel mixer_channels[SONG_MAX_TRACKS]; // as last sent
+    size_t mixer_track;
+    Limiter limiter; // master bus, after the mixer
 
     UI ui;
+    SceneShader scene_shader;
+    bool use_immediate_visuals;
+    Particles particles;
+    bool hide_particles;
 
     bool is_playing_sound;
     size_t playback_frame_counter;
 
+    // written by the audio thread, drained by the render thread every frame
+    AudioTap tap;
+    TapHistory tap_history;
+    Analyzer analyzer;
+    Spectrogram spectrogram;
+    bool hide_spectrogram;
+    Overview overview;
+    float overview_zoom;
+    bool hide_waveforms;
+
     FFMPEG *ffmpeg;
-    RenderTexture2D render_target;
-    float *audio_buffer;
+    FFMPEG *audio_ffmpeg;
+    size_t audio_skip; // export drops the frames the limiter delays by
+    Loudness loudness; // of the exported audio
+    bool normalize_export;
+    StemsExport stems;
+    RenderBatch batch;
+    RenderTexture2D render_target; // export resolution
+    MsaaTarget export_msaa;
+    int export_msaa_samples;       // 0 for none
+    Preview preview;
+    FrameTimes frame_times;
+    bool show_frame_times;
+    _Atomic(float) audio_load_peak; // written by the audio thread
+    Trace trace;
+    float audio_buffer[AUDIO_BUFFER_FRAMES * NUMBER_OF_CHANNELS];
+    float oversampled_buffer[AUDIO_BUFFER_FRAMES * EXPORT_OVERSAMPLING * NUMBER_OF_CHANNELS];
 } State;
 
 static State *state = NULL;
 
-// AUDIO
+// SONG
 
-float sine_wave(float phase) {
-    return sinf(phase);
+// Songs are mapped at the rate the engine renders at.
+size_t engine_sample_rate(void) {
+    return state->sample_rate * state->oversampling;
 }
 
-float triangle_wave(float phase) {
-    return 2.0f * fabsf(2.0f * (phase / (2.0f * PI) - floorf(phase / (2.0f * PI) + 0.5f))) - 1.0f;
+// Called by the audio thread, song stays valid until song_release.
+Song *song_acquire(void) {
+    for (;;) {
+        Song *song = atomic_load(&state->song);
+        atomic_store(&state->song_hazard, song);
+        if (atomic_load(&state->song) == song) return song;
+    }
 }
 
-float square_wave(float phase) {
-    return (sinf(phase) >= 0.0f) ? 1.0f : -1.0f;
+void song_release(void) {
+    atomic_store(&state->song_hazard, NULL);
 }
 
-float track1_produce_sample(Track *track, int setting_position) {
-    float signal1 = sine_wave(track->phases.wave1);
-    float signal2 = sine_wave(track->phases.wave2) * 0.5f + 0.5f;
-    float signal3 = sine_wave(track->phases.wave3) * 0.5f + 0.5f;
-    float value = signal1 * signal2;
-
-    // produce next phase value
-
-    float wave1 = track->settings[setting_position].wave1 * signal3;
-    float wave2 = track->settings[setting_position].wave2;
-    float wave3 = track->settings[setting_position].wave3;
-
-    track->phases.wave1 += 2.0f * PI * wave1 / SAMPLE_RATE;
-    track->phases.wave2 += 2.0f * PI * wave2 / SAMPLE_RATE;
-    track->phases.wave3 += 2.0f * PI * wave3 / SAMPLE_RATE;
-
-    if (track->phases.wave1 >= 2.0f * PI) track->phases.wave1 -= 2.0f * PI;
-    if (track->phases.wave2 >= 2.0f * PI) track->phases.wave2 -= 2.0f * PI;
-    if (track->phases.wave3 >= 2.0f * PI) track->phases.wave3 -= 2.0f * PI;
-
-    return value;
+void song_swap(Song *next) {
+    Song *previous = atomic_exchange(&state->song, next);
+    while (previous != NULL && atomic_load(&state->song_hazard) == previous) {
+        usleep(100);
+    }
+    if (previous != NULL && state->overview.song == previous) overview_free(&state->overview);
+    if (previous != NULL && state->stems.song == previous) stems_stop(&state->stems);
+    song_unmap(previous);
 }
 
-float track2_produce_sample(Track *track, int setting_position) {
-    float signal1 = sine_wave(track->phases.wave1);
-    float signal2 = square_wave(track->phases.wave2) * 0.5f + 0.5f;
-    float signal3 = square_wave(track->phases.wave3) * 0.5f + 0.5f;
-    float value = signal1 * signal2 * signal3;
-
-    // produce next phase value
-
-    float wave1 = track->settings[setting_position].wave1;
-    float wave2 = track->settings[setting_position].wave2;
-    float wave3 = track->settings[setting_position].wave3;
+void song_reload_if_modified(void) {
+    if (state->is_song_generated) return;
 
-    track->phases.wave1 += 2.0f * PI * wave1 / SAMPLE_RATE;
-    track->phases.wave2 += 2.0f * PI * wave2 / SAMPLE_RATE;
-    track->phases.wave3 += 2.0f * PI * wave3 / SAMPLE_RATE;
+    int64_t source_time = file_modified_time(SONG_SOURCE_PATH);
+    if (source_time != state->song_source_time) {
+        state->song_source_time = source_time;
+        if (source_time > file_modified_time(SONG_BINARY_PATH)) {
+            song_compile(SONG_SOURCE_PATH, SONG_BINARY_PATH);
+        }
+    }
 
-    if (track->phases.wave1 >= 2.0f * PI) track->phases.wave1 -= 2.0f * PI;
-    if (track->phases.wave2 >= 2.0f * PI) track->phases.wave2 -= 2.0f * PI;
-    if (track->phases.wave3 >= 2.0f * PI) track->phases.wave3 -= 2.0f * PI;
+    int64_t binary_time = file_modified_time(SONG_BINARY_PATH);
+    if (binary_time == 0 || binary_time == state->song_binary_time) return;
+    state->song_binary_time = binary_time;
 
-    return value;
+    Song *song = song_map(SONG_BINARY_PATH, engine_sample_rate());
+    if (song == NULL) return;
+    song_swap(song);
+    printf("Loaded song: %zu tracks, %zu settings.\n", song->track_count, song->settings_count);
 }
 
-float track3_produce_sample(Track *track, int setting_position) {
-    float signal1 = triangle_wave(track->phases.wave1);
-    float signal2 = sine_wave(track->phases.wave2) * 0.5f + 0.5f;
-    float value = signal1 * signal2;
+static uint32_t hash_step(uint32_t x) {
+    x ^= x >> 16; x *= 0x7feb352d;
+    x ^= x >> 15; x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
 
-    // produce next phase value
+// Generative set, any step can be produced independently of the others.
+void generate_drift(void *user, size_t first_step, size_t count, size_t track_count, Setting *out) {
+    (void)user;
+    static const float bass_notes[] = { 60, 70, 80, 90, 600, 700, 900 };
+
+    memset(out, 0, count * track_count * sizeof(Setting));
+    for (size_t i = 0; i < count; i++) {
+        size_t step = first_step + i;
+        uint32_t step_hash = hash_step(step);
+        uint32_t bar_hash = hash_step(step / 16 + 7919);
+        Setting *row = &out[i * track_count];
+
+        row[0] = (Setting) {
+            .wave1 = (step_hash & 3) ? 100.0f * (1 + step_hash % 4) : 0,
+            .wave3 = bass_notes[(bar_hash + step) % 7],
+        };
 
-    float wave1 = track->settings[setting_position].wave1;
-    float wave2 = track->settings[setting_position].wave2;
-    float wave3 = track->settings[setting_position].wave3;
+        if (track_count < 2) continue;
+        row[1] = (Setting) {
+            .wave1 = (step_hash >> 8) % 5 == 0 ? 400 : 0,
+            .wave2 = (step / 16) % 4 < 2 ? 0.05f : 10.0f,
+            .wave3 = (bar_hash & 1) ? 20 : 0,
+        };
 
-    track->phases.wave1 += 2.0f * PI * wave1 / SAMPLE_RATE;
-    track->phases.wave2 += 2.0f * PI * wave2 / SAMPLE_RATE;
-    track->phases.wave3 += 2.0f * PI * wave3 / SAMPLE_RATE;
+        if (track_count < 3) continue;
+        if (step % 4 == 0)        row[2] = (Setting) { .wave1 = 20, .wave2 = 50 };
+        else if (step % 16 == 14) row[2] = (Setting) { .wave1 = 90 };
+        else                      row[2] = (Setting) { .wave2 = (step_hash >> 16) % 3 == 0 ? 80 : 0 };
+    }
+}
 
-    if (track->phases.wave1 >= 2.0f * PI) track->phases.wave1 -= 2.0f * PI;
-    if (track->phases.wave2 >= 2.0f * PI) track->phases.wave2 -= 2.0f * PI;
-    if (track->phases.wave3 >= 2.0f * PI) track->phases.wave3 -= 2.0f * PI;
+Song *generated_song_create(size_t sample_rate) {
+    TrackInfo tracks[] = {
+        song_track_info("bass",  VOICE_BASS,  0.4f),
+        song_track_info("beeps", VOICE_BEEPS, 0.2f),
+        song_track_info("beat",  VOICE_BEAT,  0.9f),
+    };
+    return song_generate(generate_drift, NULL, tracks, 3, GENERATED_SONG_SETTINGS, sample_rate);
+}
 
-    return value;
+void song_toggle_generated(void) {
+    state->is_song_generated = !state->is_song_generated;
+    if (state->is_song_generated) {
+        song_swap(generated_song_create(engine_sample_rate()));
+        printf("Playing generated song: %d settings.\n", GENERATED_SONG_SETTINGS);
+    } else {
+        state->song_binary_time = 0;
+        song_reload_if_modified();
+    }
 }
 
+// AUDIO
+
 void audio_callback(ma_device *device, void *output, const void *input, ma_uint32 frames_count) {
     (void)device;
     (void)input;
 
-    if (device != NULL && !state->is_playing_sound) {
+    Song *song = song_acquire();
+
+    if (song == NULL || (device != NULL && !state->is_playing_sound)) {
+        song_release();
         memset(output, 0, sizeof(float) * frames_count * NUMBER_OF_CHANNELS);
         return;
     }
 
-    for (size_t i = 0; i < frames_count; i++) {
-        size_t frame = state->playback_frame_counter + i;
-        int setting_position = (frame / FRAMES_PER_SETTING) % state->settings_count;
-
-        // reset phases to 0 on repeat
-        int previous_setting_position = ((frame-1) / FRAMES_PER_SETTING) % state->settings_count;
-        if (previous_setting_position > setting_position) {
-            state->track1.phases = (Phases) {0};
-            state->track2.phases = (Phases) {0};
+    // offline rendering may wait for steps to be paged in, playback may not
+    bool wait_for_steps = device == NULL;
+    mixer_apply(&state->mixer, &state->mixer_queue);
+    uint64_t float_mode = simd_flush_denormals();
+    uint64_t zone = trace_begin(&state->trace);
+    double start = frame_times_now();
+    size_t oversampling = state->oversampling;
+    if (oversampling == 1) {
+        render_song(song, state->tracks, state->playback_frame_counter, output, frames_count,
+                    STEP_READER_AUDIO, wait_for_steps, &state->tap, NULL, &state->mixer);
+    } else {
+        // a buffer at a time at the engine rate, then down to the output rate
+        float *samples = output;
+        for (size_t i = 0; i < frames_count; i += AUDIO_BUFFER_FRAMES) {
+            size_t frames = frames_count - i < AUDIO_BUFFER_FRAMES ? frames_count - i : AUDIO_BUFFER_FRAMES;
+            render_song(song, state->tracks, state->playback_frame_counter + i * oversampling,
+                        state->oversampled_buffer, frames * oversampling,
+                        STEP_READER_AUDIO, wait_for_steps, &state->tap, NULL, &state->mixer);
+            decimator_process(&state->decimator, state->oversampled_buffer, samples + i * NUMBER_OF_CHANNELS, frames);
         }
+    }
+    limiter_process(&state->limiter, output, frames_count);
+    simd_restore_denormals(float_mode);
+
+    song_release();
+    float period = (float)frames_count / state->sample_rate;
+    audio_load_report(&state->audio_load_peak, (frame_times_now() - start) / period);
+    trace_end(&state->trace, device != NULL ? TRACE_THREAD_AUDIO : TRACE_THREAD_RENDER, "audio_callback", zone);
+    state->playback_frame_counter += frames_count * oversampling;
+}
 
-        float value = 0;
-        value += track1_produce_sample(&state->track1, setting_position) * 0.4f;
-        value += track2_produce_sample(&state->track2, setting_position) * 0.2f;
-        value += track3_produce_sample(&state->track3, setting_position) * 0.9f;
-
-        ((float*)output)[i * NUMBER_OF_CHANNELS + 0] = value;
-        ((float*)output)[i * NUMBER_OF_CHANNELS + 1] = value;
+// Sets the output rate, the engine renders at oversampling times it. All
+// that depends on the rate is set up again and the song is mapped again at
+// the engine rate. The audio thread must not be rendering.
+void audio_set_sample_rate(size_t sample_rate, size_t oversampling) {
+    bool was_set = state->sample_rate != 0;
+    bool is_limiter_enabled = atomic_load(&state->limiter.is_enabled);
+    bool is_true_peak = atomic_load(&state->limiter.is_true_peak);
+
+    state->sample_rate = sample_rate;
+    state->oversampling = oversampling;
+    size_t engine_rate = engine_sample_rate();
+    limiter_init(&state->limiter, sample_rate, LIMITER_CEILING_DB, LIMITER_LOOKAHEAD_MS, LIMITER_RELEASE_MS);
+    if (was_set) {
+        atomic_store(&state->limiter.is_enabled, is_limiter_enabled);
+        atomic_store(&state->limiter.is_true_peak, is_true_peak);
     }
+    effects_init(&state->mixer.effects, engine_rate);
+    decimator_init(&state->decimator);
+    spectrum_set_sample_rate(&state->analyzer, engine_rate);
+
+    Song *song = atomic_load(&state->song);
+    if (song != NULL && song->tempo.sample_rate != engine_rate) {
+        song = state->is_song_generated ? generated_song_create(engine_rate) : song_map(SONG_BINARY_PATH, engine_rate);
+        if (song != NULL) song_swap(song);
+    }
+}
 
-    state->playback_frame_counter += frames_count;
+// Stops the device around the change, it keeps its own rate and plays
+// silence unless playback is on.
+void audio_switch_sample_rate(size_t sample_rate, size_t oversampling) {
+    ma_device_stop(&state->audio_device);
+    audio_set_sample_rate(sample_rate, oversampling);
+    ma_device_start(&state->audio_device);
+}
+
+size_t export_sample_rate(void) {
+    size_t rate = export_sample_rates[state->export_rate_index];
+    if (rate == 0) rate = state->device_sample_rate;
+    return rate < AUDIO_MAX_SAMPLE_RATE ? rate : AUDIO_MAX_SAMPLE_RATE;
 }
 
 void init_audio_device(void) {
@@ -197,120 +345,94 @@ void init_audio_device(void) {
     config.playback.format = ma_format_f32;
     config.playback.channels = NUMBER_OF_CHANNELS;
 
-    config.sampleRate = SAMPLE_RATE;
+    // 0 is the native rate of the device, miniaudio does not resample then
+    config.sampleRate = 0;
     config.dataCallback = audio_callback;
 
     if (ma_device_init(NULL, &config, &state->audio_device) != MA_SUCCESS) {
         printf("Error initializing audio device.\n");
+        state->device_sample_rate = AUDIO_DEFAULT_SAMPLE_RATE;
+        if (state->sample_rate == 0) audio_set_sample_rate(state->device_sample_rate, 1);
         return;
     }
 
+    // an export keeps its rate until it is done
+    state->device_sample_rate = state->audio_device.sampleRate;
+    if (state->ffmpeg == NULL && state->sample_rate != state->device_sample_rate) {
+        audio_set_sample_rate(state->device_sample_rate, 1);
+    }
     ma_device_start(&state->audio_device);
     printf("Audio device initialized and started.\n");
 }
 
-#define SET(s1, s2, s3) current_track->settings[c++] = (Setting) { s1, s2, s3 };
-
-void setup_settings(void) {
-    state->settings_count = 128;
-
-    if (state->track1.settings != NULL) {
-        free(state->track1.settings);
-        state->track1.settings = NULL;
-    }
-    if (state->track2.settings != NULL) {
-        free(state->track2.settings);
-        state->track2.settings = NULL;
-    }
-    if (state->track3.settings != NULL) {
-        free(state->track3.settings);
-        state->track3.settings = NULL;
-    }
-
-    // TRACK 1 - BASS
-    Track *current_track = &state->track1;
-    state->track1.settings = malloc(state->settings_count * sizeof(Setting));
-    assert(current_track->settings != NULL && "Uninitialized");
-    size_t c = 0;
-
-    for (int i = 0; i < 2; i++) {
-        SET(200, 0, 60);   SET(200, 0, 70);   SET(200, 0, 80);  SET(100, 0, 900);
-        SET(0,   0, 40);   SET(0,   0, 40);   SET(400, 0, 9);   SET(100, 0, 9);
-        SET(200, 0, 600);  SET(200, 0, 70);   SET(200, 0, 80);  SET(900, 0, 0);
-        SET(200, 0, 0);    SET(100, 0, 0);    SET(600, 0, 0);   SET(0,   0, 0);
-
-        SET(200, 0, 600);  SET(200, 0, 700);  SET(200, 0, 80);  SET(100, 0, 90);
-        SET(0,   0, 0);    SET(0,   0, 0);    SET(400, 0, 0);   SET(100, 0, 0);
-        SET(200, 0, 600);  SET(200, 0, 700);  SET(200, 0, 80);  SET(200, 0, 90);
-        SET(200, 0, 0);    SET(100, 0, 0);    SET(400, 0, 0);   SET(0,   0, 0);
-
-        SET(200, 0, 60);   SET(200, 0, 70);   SET(200, 0, 80);  SET(100, 0, 900);
-        SET(0,   0, 0);    SET(0,   0, 0);    SET(400, 0, 900); SET(100, 0, 900);
-        SET(200, 0, 600);  SET(200, 0, 70);   SET(200, 0, 80);  SET(900, 0, 0);
-        SET(200, 0, 0);    SET(100, 0, 0);    SET(600, 0, 0);   SET(0,   0, 0);
-
-        SET(200, 0, 600);  SET(200, 0, 700);  SET(200, 0, 80);  SET(100, 0, 90);
-        SET(0,   0, 40);   SET(0,   0, 40);   SET(400, 0, 9);   SET(100, 0, 9);
-        SET(200, 0, 600);  SET(200, 0, 700);  SET(200, 0, 80);  SET(200, 0, 90);
-        SET(200, 0, 400);  SET(100, 0, 400);  SET(400, 0, 400); SET(0,   0, 0);
-    }
-
-    // TRACK 2
-    assert(c == state->settings_count);
-    current_track = &state->track2;
-    state->track2.settings = malloc(state->settings_count * sizeof(Setting));
-    assert(current_track->settings != NULL && "Uninitialized");
-    c = 0;
-
-    for (int i = 0; i < 4; i++) {
-        SET(0, 0, 0); SET(0, 0, 0); SET(0, 0, 0); SET(0, 0, 0);
-        SET(0, 0, 0); SET(0, 0, 0); SET(0, 0, 0); SET(0, 0, 0);
-        SET(0, 0, 0); SET(0, 0, 0); SET(0, 0, 0); SET(0, 0, 0);
-        SET(0, 0, 0); SET(0, 0, 0); SET(0, 0, 0); SET(0, 0, 0);
-    }
-
-    SET(  0,  0.01, 0); SET(  0,  0.05, 0); SET(  0,  0.05, 0); SET(  0,  0.05, 0);
-    SET(  0,  0.05, 0); SET(  0,  0.05, 0); SET(  0,  0.05, 0); SET(  0,  0.05, 0);
-    SET(  0,  0.10, 0); SET(  0,  0.10, 0); SET(400,  0.10, 0); SET(400,  0.10, 0);
-    SET(400,  10.0, 0); SET(  0,  10.0, 0); SET(400,  10.0, 0); SET(  0,  10.0, 0);
-
-    SET(400,  10.0,  0); SET(  0,  10.0,  0); SET(400,  10.0, 0); SET(  0,  10.0, 0);
-    SET(400,  0.10, 20); SET(  0,  0.10,  0); SET(  0,  0.10, 0); SET(  0,  0.10, 0);
-    SET(  0,  0.05, 20); SET(  0,  0.05,  0); SET(  0,  0.05, 0); SET(400,  0.05, 0);
-    SET(400,  10.0, 20); SET(  0,  10.0, 20); SET(400,  10.0, 0); SET(  0,  10.0, 0);
-
-    SET(  0,  0.01, 0); SET(  0,  0.05, 0); SET(  0,  0.05, 0); SET(  0,  0.05, 0);
-    SET(  0,  0.05, 0); SET(  0,  0.05, 0); SET(  0,  0.05, 0); SET(  0,  0.05, 0);
-    SET(  0,  0.10, 0); SET(  0,  0.10, 0); SET(400,  0.10, 0); SET(400,  0.10, 0);
-    SET(400,  10.0, 0); SET(  0,  10.0, 0); SET(400,  10.0, 0); SET(  0,  10.0, 0);
-
-    SET(400,  10.0,  0); SET(  0,  10.0,  0); SET(400,  10.0, 0); SET(  0,  10.0, 0);
-    SET(400,  0.10, 20); SET(  0,  0.10,  0); SET(  0,  0.10, 0); SET(  0,  0.10, 0);
-    SET(  0,  0.05, 20); SET(  0,  0.05,  0); SET(  0,  0.05, 0); SET(400,  0.05, 0);
-    SET(400,  10.0, 20); SET(  0,  10.0, 20); SET(400,  10.0, 0); SET(  0,  10.0, 0);
-
-    // TRACK 3 - BEAT
-    assert(c == state->settings_count);
-    current_track = &state->track3;
-    state->track3.settings = malloc(state->settings_count * sizeof(Setting));
-    assert(current_track->settings != NULL && "Uninitialized");
-    c = 0;
-
-    for (int i = 0; i < 8; i++) {
-        SET( 20, 50, 0); SET(0,  0, 0); SET(  0, 20, 0); SET(  0, 80, 0);
-        SET( 20,  0, 0); SET(0,  0, 0); SET(  0,  0, 0); SET(  0,  0, 0);
-        SET( 20, 20, 0); SET(0,  0, 0); SET(  0,  0, 0); SET(  0, 80, 0);
-        SET( 50, 50, 0); SET(0,  0, 0); SET( 90,  0, 0); SET(  0,  0, 0);
-    }
-
-    assert(c == state->settings_count);
+// Playback frame that is leaving the speakers now, the device buffers and
+// the limiter are still ahead of it. Offline rendering makes up for both.
+uint64_t audible_frame(void) {
+    uint64_t latency = 0;
+    if (state->ffmpeg == NULL) {
+        latency = (uint64_t)state->audio_device.playback.internalPeriodSizeInFrames
+                * state->audio_device.playback.internalPeriods
+                + limiter_latency(&state->limiter);
+    }
+    uint64_t counter = state->playback_frame_counter;
+    return counter > latency ? counter - latency : 0;
 }
 
 void playback_reset(void) {
     state->playback_frame_counter = 0;
-    state->track1.phases = (Phases) {0};
-    state->track2.phases = (Phases) {0};
-    state->track3.phases = (Phases) {0};
+    memset(state->tracks, 0, sizeof(state->tracks));
+    limiter_request_reset(&state->limiter);
+    effects_request_reset(&state->mixer.effects);
+}
+
+// Frames the export starts late by, the limiter and the decimator delay it.
+size_t export_latency(void) {
+    return limiter_latency(&state->limiter) + (state->oversampling > 1 ? DECIMATOR_LATENCY : 0);
+}
+
+// Writes frames of the audio buffer into the export, without the ones it
+// starts late by.
+bool export_audio_write(size_t frames) {
+    size_t skip = state->audio_skip < frames ? state->audio_skip : frames;
+    state->audio_skip -= skip;
+    float *samples = state->audio_buffer + skip * NUMBER_OF_CHANNELS;
+    loudness_add(&state->loudness, samples, frames - skip);
+    return ffmpeg_send_sound_samples(state->audio_ffmpeg, samples, sizeof(float) * (frames - skip) * NUMBER_OF_CHANNELS);
+}
+
+// Effect tails into frames of the audio buffer, rendered at the engine rate.
+static void export_render_tail(size_t frames) {
+    if (state->oversampling == 1) {
+        mixer_render_tail(&state->mixer, state->audio_buffer, frames);
+        return;
+    }
+    mixer_render_tail(&state->mixer, state->oversampled_buffer, frames * state->oversampling);
+    decimator_process(&state->decimator, state->oversampled_buffer, state->audio_buffer, frames);
+}
+
+// The song is over, effects ring out until they are quiet and then what the
+// limiter and the decimator still hold comes out.
+bool export_audio_tail(void) {
+    bool ok = true;
+
+    size_t tail = EFFECTS_MAX_TAIL_SECONDS * state->sample_rate;
+    while (ok && tail > 0 && !effects_is_silent(&state->mixer.effects)) {
+        size_t frames = tail < AUDIO_BUFFER_FRAMES ? tail : AUDIO_BUFFER_FRAMES;
+        export_render_tail(frames);
+        limiter_process(&state->limiter, state->audio_buffer, frames);
+        ok = export_audio_write(frames);
+        tail -= frames;
+    }
+
+    tail = export_latency();
+    while (ok && tail > 0) {
+        size_t frames = tail < AUDIO_BUFFER_FRAMES ? tail : AUDIO_BUFFER_FRAMES;
+        export_render_tail(frames);
+        limiter_process(&state->limiter, state->audio_buffer, frames);
+        ok = export_audio_write(frames);
+        tail -= frames;
+    }
+    return ok;
 }
 
 void playback_play(void) {
@@ -330,27 +452,79 @@ void plug_init(void) {
 
     SetExitKey(KEY_Q);
     SetWindowSize(VIDEO_WIDTH, VIDEO_HEIGHT);
+    render_batch_load(&state->batch, RENDER_BATCH_BUFFERS, RENDER_BATCH_ELEMENTS);
     state->render_target = LoadRenderTexture(VIDEO_WIDTH, VIDEO_HEIGHT);
+    state->export_msaa_samples = 4;
+    state->scene_shader = scene_shader_load();
+    particles_init(&state->particles);
+    particles_start_worker(&state->particles);
+    spectrum_init(&state->analyzer, AUDIO_DEFAULT_SAMPLE_RATE);
+    for (size_t t = 0; t < SONG_MAX_TRACKS; t++) {
+        state->mixer_channels[t].send = EFFECTS_DEFAULT_SEND;
+        mixer_send(&state->mixer_queue, t, state->mixer_channels[t]);
+    }
+    spectrum_start_worker(&state->analyzer);
+    spectrogram_load(&state->spectrogram);
     init_audio_device();
-    setup_settings();
+    song_reload_if_modified();
 }
 
 void plug_cleanup(void) {
+    trace_stop(&state->trace);
     ma_device_uninit(&state->audio_device);
+    overview_free(&state->overview);
+    stems_stop(&state->stems);
+    song_unmap(atomic_load(&state->song));
+    scene_shader_unload(&state->scene_shader);
+    preview_unload(&state->preview);
+    msaa_unload(&state->export_msaa);
+    UnloadRenderTexture(state->render_target);
+    particles_free(&state->particles);
+    spectrum_stop_worker(&state->analyzer);
+    spectrum_free(&state->analyzer);
+    spectrogram_unload(&state->spectrogram);
+    render_batch_unload(&state->batch);
     free(state);
     state = NULL;
 }
 
 void *plug_pre_reload(void) {
+    uint64_t zone = trace_begin(&state->trace);
     ma_device_uninit(&state->audio_device);
+    overview_stop_worker(&state->overview);
+    stems_stop(&state->stems);
+    song_stop_worker(atomic_load(&state->song));
+    particles_stop_worker(&state->particles);
+    spectrum_stop_worker(&state->analyzer);
+    trace_end(&state->trace, TRACE_THREAD_RENDER, "plug_pre_reload", zone);
+
+    // zone names live in this plugin
+    trace_flush(&state->trace);
     return state;
 }
 
 void plug_post_reload(void *old_state) {
     state = old_state;
+    uint64_t zone = trace_begin(&state->trace);
     init_audio_device();
-    setup_settings();
+
+    // shader source may have changed with the plugin
+    scene_shader_unload(&state->scene_shader);
+    state->scene_shader = scene_shader_load();
+    particles_unload_shader(&state->particles);
+    particles_load_shader(&state->particles);
+    particles_start_worker(&state->particles);
+    spectrum_start_worker(&state->analyzer);
+
+    // generator callback points into the old plugin, recreate the song
+    if (state->is_song_generated) {
+        song_swap(generated_song_create(engine_sample_rate()));
+    } else {
+        song_start_worker(atomic_load(&state->song));
+        overview_start_worker(&state->overview);
+    }
     playback_reset();
+    trace_end(&state->trace, TRACE_THREAD_RENDER, "plug_post_reload", zone);
 }
 
 // UI
@@ -364,12 +538,19 @@ void animate_ease_in(float *current, float target, float elapsed, float duration
     }
 }
 
-void DrawFrame(int setting_position, float delta_time) {
+// Draws in output coordinates, the target is scale times the output size.
+void DrawFrame(Song *song, int setting_position, uint64_t audible, float scale, bool wait_for_steps, float delta_time) {
+    const Setting *row = song_row(song, STEP_READER_RENDER, setting_position, wait_for_steps);
+    int width = VIDEO_WIDTH;
+    int height = VIDEO_HEIGHT;
+    Vector2 center = { (float)width/2, (float)height/2 };
+    Scene scene = {0};
+
     { // TRACK 1 - BASS
-        Track track = state->track1;
-        float freq1 = track.settings[setting_position].wave1;
-        float freq2 = track.settings[setting_position].wave2;
-        float freq3 = track.settings[setting_position].wave3;
+        const Setting *setting = track_setting(song, row, 0);
+        float freq1 = setting->wave1;
+        float freq2 = setting->wave2;
+        float freq3 = setting->wave3;
 
         state->ui.track2_color_r_target = 0.2 * freq1;
         state->ui.track2_color_g_target = freq2;
@@ -380,31 +561,28 @@ void DrawFrame(int setting_position, float delta_time) {
         animate_ease_in(&state->ui.track2_color_g_value, state->ui.track2_color_g_target, delta_time, duration);
         animate_ease_in(&state->ui.track2_color_b_value, state->ui.track2_color_b_target, delta_time, duration);
 
-        Color color = {
+        scene.background = (Color) {
             state->ui.track2_color_r_value,
             state->ui.track2_color_g_value,
             state->ui.track2_color_b_value,
             100
         };
-        DrawRectangle(0, 0, GetScreenWidth(), GetScreenHeight(), color);
     }
 
     { // TRACK 2 - BEEPS
-        Track track = state->track2;
-        float freq1 = track.settings[setting_position].wave1;
-        float freq2 = track.settings[setting_position].wave2;
-        float freq3 = track.settings[setting_position].wave3;
+        const Setting *setting = track_setting(song, row, 1);
+        float freq1 = setting->wave1;
+        float freq2 = setting->wave2;
+        float freq3 = setting->wave3;
 
         if (freq1 > 0) {
-            DrawRing(
-                (Vector2) { (float)GetScreenWidth()/2, (float)GetScreenHeight()/2 },
-                40 * freq2,
-                40 * freq2 + 700,
-                ((10 + freq3) * setting_position) + state->ui.track1_circle_position,
-                ((10 + freq3) * setting_position) + state->ui.track1_circle_position + 10,
-                50,
-                WHITE
-            );
+            scene.has_ring = true;
+            scene.ring_center = center;
+            scene.ring_inner_radius = 40 * freq2;
+            scene.ring_outer_radius = 40 * freq2 + 700;
+            scene.ring_start_angle = ((10 + freq3) * setting_position) + state->ui.track1_circle_position;
+            scene.ring_end_angle = scene.ring_start_angle + 10;
+            scene.ring_color = WHITE;
         }
 
         state->ui.track1_circle_position += freq1;
@@ -412,9 +590,9 @@ void DrawFrame(int setting_position, float delta_time) {
 
 
     { // TRACK 3 - BEAT
-        Track track = state->track3;
-        float freq1 = track.settings[setting_position].wave1;
-        float freq2 = track.settings[setting_position].wave2;
+        const Setting *setting = track_setting(song, row, 2);
+        float freq1 = setting->wave1;
+        float freq2 = setting->wave2;
 
         state->ui.track3_circle_size_target = 20 + (freq1 * 5);
         state->ui.track3_circle_color_target = 200 + (freq2);
@@ -422,15 +600,102 @@ void DrawFrame(int setting_position, float delta_time) {
         animate_ease_in(&state->ui.track3_circle_size_value, state->ui.track3_circle_size_target, delta_time, 0.025f);
         animate_ease_in(&state->ui.track3_circle_color_value, state->ui.track3_circle_color_target, delta_time, 0.045f);
 
-        DrawCircle(GetScreenWidth()/2, GetScreenHeight()/2, 
-            state->ui.track3_circle_size_value, 
-            (Color) { state->ui.track3_circle_color_value, 0, 0, 255 });
+        scene.circle_center = (Vector2) { (int)center.x, (int)center.y };
+        scene.circle_radius = state->ui.track3_circle_size_value;
+        scene.circle_color = (Color) { state->ui.track3_circle_color_value, 0, 0, 255 };
+    }
+
+    // a shader that failed to compile falls back to the default one without the uniform
+    if (state->use_immediate_visuals || state->scene_shader.scene_location < 0) {
+        draw_scene_immediate(&scene, width, height);
+    } else {
+        render_batch_flush(&state->batch);
+        draw_scene_shader(&state->scene_shader, &state->batch, &scene, width, height, scale);
+    }
+
+    const Spectrum *spectrum = spectrum_latest(&state->analyzer);
+    if (spectrum->channel_count > 0) {
+        Color color = scene.circle_color;
+        color.a = 200;
+        draw_spectrum_ring(spectrum->bands[TAP_CHANNEL_MIX], SPECTRUM_BANDS, scene.circle_center,
+                           scene.circle_radius + 8, 160, color);
+    }
+
+    spectrogram_push(&state->spectrogram, spectrum, TAP_CHANNEL_MIX);
+    if (!state->hide_spectrogram) {
+        Rectangle strip = { 0, height - 120, width, 120 };
+        spectrogram_draw(&state->spectrogram, strip, (Color) { 255, 255, 255, 180 });
+    }
+
+    if (!state->hide_waveforms) {
+        // a line per pixel in both
+        render_batch_reserve(&state->batch, 4 * width + 16, 8);
+
+        uint64_t song_frames = tempo_song_frames(&song->tempo);
+        uint64_t playhead = audible % song_frames;
+
+        // visible part of the song follows the playhead
+        float zoom = state->overview_zoom < 1 ? 1 : state->overview_zoom;
+        uint64_t span = (uint64_t)(song_frames / zoom);
+        if (span < 256) span = 256;
+        if (span > song_frames) span = song_frames;
+        uint64_t first = playhead > span / 2 ? playhead - span / 2 : 0;
+        if (first + span > song_frames) first = song_frames - span;
+
+        Rectangle overview_area = { 0, 0, width, 80 };
+        overview_draw(&state->overview, overview_area, first, first + span, playhead, (Color) { 200, 200, 200, 255 });
+
+        Rectangle scope_area = { width - 320, 90, 300, 120 };
+        scope_draw(&state->tap_history, audible, scope_area, (Color) { 120, 255, 160, 255 });
+    }
+
+    if (!state->hide_particles) {
+        particles_wait(&state->particles);
+        render_batch_flush(&state->batch);
+        particles_draw(&state->particles, width, height);
+        particles_step(&state->particles, &scene, delta_time, width, height);
+    }
+}
+
+// 1-8 pick a track, - and = change its gain, [ and ] its pan, comma and
+// period its send to the effects, N mutes and O solos it.
+void mixer_update_keys(const Song *song) {
+    for (int key = KEY_ONE; key <= KEY_EIGHT; key++) {
+        if (IsKeyPressed(key)) state->mixer_track = key - KEY_ONE;
+    }
+    if (song == NULL || state->mixer_track >= song->track_count) return;
+
+    MixerChannel channel = state->mixer_channels[state->mixer_track];
+    if (IsKeyPressed(KEY_MINUS)) channel.gain_db = fmaxf(channel.gain_db - 1, MIXER_MIN_GAIN_DB);
+    if (IsKeyPressed(KEY_EQUAL)) channel.gain_db = fminf(channel.gain_db + 1, MIXER_MAX_GAIN_DB);
+    if (IsKeyPressed(KEY_LEFT_BRACKET)) channel.pan = fmaxf(channel.pan - 0.1f, -1);
+    if (IsKeyPressed(KEY_RIGHT_BRACKET)) channel.pan = fminf(channel.pan + 0.1f, 1);
+    if (IsKeyPressed(KEY_COMMA)) channel.send = fmaxf(channel.send - 0.1f, 0);
+    if (IsKeyPressed(KEY_PERIOD)) channel.send = fminf(channel.send + 0.1f, 1);
+    if (IsKeyPressed(KEY_N)) channel.is_muted = !channel.is_muted;
+    if (IsKeyPressed(KEY_O)) channel.is_solo = !channel.is_solo;
+
+    if (memcmp(&channel, &state->mixer_channels[state->mixer_track], sizeof(channel)) == 0) return;
+    if (mixer_send(&state->mixer_queue, state->mixer_track, channel)) {
+        state->mixer_channels[state->mixer_track] = channel;
+    } else {
+        printf("plug.c: mixer_update_keys: Error: mixer queue is full\n");
     }
 }
 
 void plug_update(void) {
     char text[256] = {0};
     bool is_rendering = state->ffmpeg != NULL;
+    frame_times_begin(&state->frame_times);
+    frame_times_audio_load(&state->frame_times, &state->audio_load_peak);
+    trace_flush(&state->trace);
+    uint64_t update_zone = trace_begin(&state->trace);
+
+    uint64_t zone = trace_begin(&state->trace);
+    if (!is_rendering) song_reload_if_modified();
+    trace_end(&state->trace, TRACE_THREAD_RENDER, "song_reload_if_modified", zone);
+    Song *song = atomic_load(&state->song);
+    frame_times_lap(&state->frame_times, PHASE_RELOAD);
 
     if (!is_rendering && IsKeyPressed(KEY_SPACE)) {
         if (!state->is_playing_sound) {
@@ -440,60 +705,281 @@ void plug_update(void) {
         }
     }
 
-    if (!is_rendering && IsKeyPressed(KEY_R)) {
-        playback_stop();
+    if (!is_rendering && IsKeyPressed(KEY_G)) {
+        song_toggle_generated();
+        song = atomic_load(&state->song);
+    }
+
+    if (IsKeyPressed(KEY_V)) {
+        state->use_immediate_visuals = !state->use_immediate_visuals;
+    }
+
+    if (IsKeyPressed(KEY_P)) {
+        state->hide_particles = !state->hide_particles;
+    }
+
+    if (IsKeyPressed(KEY_S)) {
+        state->hide_spectrogram = !state->hide_spectrogram;
+    }
+
+    if (IsKeyPressed(KEY_W)) {
+        state->hide_waveforms = !state->hide_waveforms;
+    }
+
+    mixer_update_keys(song);
+
+    if (IsKeyPressed(KEY_T)) {
+        if (state->trace.file == NULL) {
+            trace_start(&state->trace, "trace.json");
+        } else {
+            trace_stop(&state->trace);
+        }
+    }
+
+    if (IsKeyPressed(KEY_F1)) {
+        state->show_frame_times = !state->show_frame_times;
+    }
+
+    if (IsKeyPressed(KEY_L)) {
+        if (IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT)) {
+            bool is_true_peak = !atomic_load(&state->limiter.is_true_peak);
+            atomic_store(&state->limiter.is_true_peak, is_true_peak);
+            printf("Limiter true peak: %s\n", is_true_peak ? "on" : "off");
+        } else {
+            bool is_enabled = !atomic_load(&state->limiter.is_enabled);
+            atomic_store(&state->limiter.is_enabled, is_enabled);
+            printf("Limiter: %s\n", is_enabled ? "on" : "off");
+        }
+    }
+
+    if (!is_rendering && IsKeyPressed(KEY_K)) {
+        state->normalize_export = !state->normalize_export;
+        printf("Normalize export to %.0f LUFS: %s\n", LOUDNESS_TARGET_LUFS, state->normalize_export ? "on" : "off");
+    }
 
-        // render audio
-        state->playback_frame_counter = 0;
-        size_t buffer_size = sizeof(float) * state->settings_count * FRAMES_PER_SETTING * NUMBER_OF_CHANNELS;
-        state->audio_buffer = malloc(buffer_size);
-        audio_callback(NULL, state->audio_buffer, NULL, state->settings_count * FRAMES_PER_SETTING);
+    if (!is_rendering && IsKeyPressed(KEY_M)) {
+        int samples = state->export_msaa_samples;
+        state->export_msaa_samples = samples == 0 ? 2 : samples >= MSAA_MAX_SAMPLES ? 0 : samples * 2;
+        printf("Export MSAA: %dx\n", state->export_msaa_samples);
+    }
+
+    float wheel = GetMouseWheelMove();
+    if (wheel != 0) {
+        float zoom = state->overview_zoom < 1 ? 1 : state->overview_zoom;
+        state->overview_zoom = fmaxf(zoom * powf(1.25f, wheel), 1);
+    }
+
+    if (!is_rendering && song != NULL && song != state->overview.song) {
+        overview_start(&state->overview, song, song->tempo.sample_rate);
+    }
+
+    // stems render on their own, playback and the preview keep going
+    stems_update(&state->stems);
+    if (!is_rendering && song != NULL && state->stems.song == NULL && IsKeyPressed(KEY_E)) {
+        bool is_flac = IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT);
+        if (stems_start(&state->stems, song, "stem", is_flac ? ".flac" : ".wav")) {
+            printf("Exporting stems of %zu tracks\n", song->track_count);
+        }
+    }
+
+    if (!is_rendering && IsKeyPressed(KEY_X)) {
+        if (IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT)) {
+            state->oversample_export = !state->oversample_export;
+            printf("Export oversampling: %s\n", state->oversample_export ? "2x" : "off");
+        } else {
+            size_t count = sizeof(export_sample_rates) / sizeof(export_sample_rates[0]);
+            state->export_rate_index = (state->export_rate_index + 1) % count;
+            printf("Export sample rate: %zu Hz%s\n", export_sample_rate(), state->export_rate_index == 0 ? " (device)" : "");
+        }
+    }
+
+    if (!is_rendering && song != NULL && IsKeyPressed(KEY_R)) {
+        playback_stop();
 
-        FFMPEG *audio_ffmpeg = ffmpeg_start_rendering_audio("output.wav");
-        ffmpeg_send_sound_samples(audio_ffmpeg, state->audio_buffer, buffer_size);
-        ffmpeg_end_rendering(audio_ffmpeg, false);
+        // the export renders at its own rate, the song is mapped again for it
+        audio_switch_sample_rate(export_sample_rate(), state->oversample_export ? EXPORT_OVERSAMPLING : 1);
+        song = atomic_load(&state->song);
+        playback_reset();
+        state->audio_skip = export_latency();
+        loudness_start(&state->loudness, state->sample_rate);
 
-        // render video
-        state->playback_frame_counter = 0;
+        // audio is rendered in lockstep with the video frames, see below
+        state->audio_ffmpeg = ffmpeg_start_rendering_audio("output.wav", NUMBER_OF_CHANNELS, state->sample_rate);
         state->ffmpeg = ffmpeg_start_rendering_video("output.mp4", VIDEO_WIDTH, VIDEO_HEIGHT, VIDEO_FPS);
-        SetTargetFPS(500);
+
+        if (state->ffmpeg == NULL || state->audio_ffmpeg == NULL) {
+            if (state->ffmpeg != NULL) ffmpeg_end_rendering(state->ffmpeg, true);
+            if (state->audio_ffmpeg != NULL) ffmpeg_end_rendering(state->audio_ffmpeg, true);
+            state->ffmpeg = NULL;
+            state->audio_ffmpeg = NULL;
+            audio_switch_sample_rate(state->device_sample_rate, 1);
+            song = atomic_load(&state->song);
+        } else {
+            // without MSAA only the scene shader is antialiased
+            if (state->export_msaa_samples != 0) {
+                msaa_load(&state->export_msaa, VIDEO_WIDTH, VIDEO_HEIGHT, state->export_msaa_samples);
+            }
+            SetTargetFPS(500);
+        }
     }
 
+    float delta_time = is_rendering ? (float)1/VIDEO_FPS : GetFrameTime();
+    frame_times_lap(&state->frame_times, PHASE_INPUT);
+
+    // export waits for the spectrum so every video frame gets its own
+    tap_drain(&state->tap, &state->tap_history);
+    uint64_t tap_frame = is_rendering ? state->playback_frame_counter : audible_frame();
+    spectrum_submit(&state->analyzer, &state->tap_history, tap_frame, delta_time, is_rendering);
+
     BeginDrawing();
     ClearBackground(BLACK);
 
-    int latency_adjustment = state->ffmpeg == NULL ? 850 : 0;
-    int setting_position = ((state->playback_frame_counter + latency_adjustment) / FRAMES_PER_SETTING) % state->settings_count;
+    // step on screen is the one heard when the frame is shown, the device
+    // buffers hold back the sound and the screen holds back the frame
+    uint64_t step_frame = audible_frame();
+    if (state->ffmpeg == NULL) step_frame += VIDEO_DISPLAY_DELAY * engine_sample_rate() / VIDEO_FPS;
+    int setting_position = 0;
+
+    // preview resolution follows the window and the frame time, export is exact
+    RenderTexture2D *target = &state->render_target;
+    if (is_rendering && state->export_msaa.target.id != 0) {
+        target = &state->export_msaa.target;
+    } else if (!is_rendering) {
+        preview_update_scale(&state->preview, frame_times_last_work(&state->frame_times), GetFrameTime());
+        target = preview_target(&state->preview, GetScreenWidth(), GetScreenHeight(), VIDEO_WIDTH, VIDEO_HEIGHT);
+    }
+    float scale = (float)target->texture.width / VIDEO_WIDTH;
 
-    BeginTextureMode(state->render_target);
+    render_batch_flush(&state->batch);
+    BeginTextureMode(*target);
     ClearBackground(BLACK);
-    DrawFrame(setting_position, is_rendering ? (float)1/VIDEO_FPS : GetFrameTime());
+    BeginMode2D((Camera2D) { .zoom = scale });
+    frame_times_lap(&state->frame_times, PHASE_OTHER);
+    if (song != NULL) {
+        setting_position = tempo_find_step(&song->tempo, step_frame % tempo_song_frames(&song->tempo));
+        zone = trace_begin(&state->trace);
+        DrawFrame(song, setting_position, tap_frame, scale, is_rendering, delta_time);
+        trace_end(&state->trace, TRACE_THREAD_RENDER, "DrawFrame", zone);
+    }
+    zone = trace_begin(&state->trace);
+    render_batch_flush(&state->batch);
+    trace_end(&state->trace, TRACE_THREAD_RENDER, "render_batch_flush", zone);
+    frame_times_lap(&state->frame_times, PHASE_DRAW);
+    EndMode2D();
     EndTextureMode();
 
-    DrawTexture(state->render_target.texture, 0, 0, WHITE);
+    if (target == &state->export_msaa.target) {
+        msaa_resolve(&state->export_msaa, &state->render_target);
+        target = &state->render_target;
+    }
+    draw_target_fitted(target, GetScreenWidth(), GetScreenHeight());
 
     if (state->is_playing_sound) {
         sprintf(text, "%d", setting_position);
         DrawText(text, 20, GetScreenHeight() - 30, 20, WHITE);
     }
 
+    if (song != NULL && state->mixer_track < song->track_count) {
+        const MixerChannel *channel = &state->mixer_channels[state->mixer_track];
+        char mixer_text[128];
+        sprintf(mixer_text, "track %zu: %+.0f dB, pan %+.1f, send %.1f%s%s", state->mixer_track + 1, channel->gain_db,
+                channel->pan, channel->send,
+                channel->is_muted ? ", muted" : "", channel->is_solo ? ", solo" : "");
+        DrawText(mixer_text, 20, GetScreenHeight() - 80, 20, WHITE);
+    }
+
+    if (!atomic_load(&state->limiter.is_enabled)) {
+        DrawText("limiter off", 20, GetScreenHeight() - 105, 20, WHITE);
+    } else {
+        char limiter_text[64];
+        float reduction = 20 * log10f(atomic_load(&state->limiter.lowest_gain));
+        sprintf(limiter_text, "limiter %.1f dB%s", reduction,
+                atomic_load(&state->limiter.is_true_peak) ? " (true peak)" : "");
+        DrawText(limiter_text, 20, GetScreenHeight() - 105, 20, WHITE);
+    }
+
+    if (state->stems.song != NULL) {
+        char stems_text[64];
+        uint64_t rendered = atomic_load(&state->stems.rendered_frames);
+        sprintf(stems_text, "stems %d%%", (int)(100 * rendered / state->stems.song_frames));
+        DrawText(stems_text, 20, GetScreenHeight() - 55, 20, WHITE);
+    }
+
+    long encoder_queue = -1;
     if (is_rendering) {
         DrawText(text, 20, GetScreenHeight() - 30, 20, WHITE);
 
+        char loudness_text[96];
+        sprintf(loudness_text, "M %.1f  S %.1f  I %.1f LUFS", state->loudness.momentary, state->loudness.short_term,
+                loudness_integrated(&state->loudness));
+        DrawText(loudness_text, 20, GetScreenHeight() - 130, 20, WHITE);
+        frame_times_lap(&state->frame_times, PHASE_OTHER);
+
+        zone = trace_begin(&state->trace);
         Image image = LoadImageFromTexture(state->render_target.texture);
-        if (!ffmpeg_send_frame_flipped(state->ffmpeg, image.data, image.width, image.height)) {
-            ffmpeg_end_rendering(state->ffmpeg, true);
+        trace_end(&state->trace, TRACE_THREAD_RENDER, "readback", zone);
+        frame_times_lap(&state->frame_times, PHASE_READBACK);
+        zone = trace_begin(&state->trace);
+        bool ok = ffmpeg_send_frame_flipped(state->ffmpeg, image.data, image.width, image.height);
+        trace_end(&state->trace, TRACE_THREAD_RENDER, "ffmpeg video", zone);
+        UnloadImage(image);
+        frame_times_lap(&state->frame_times, PHASE_PIPE);
+
+        // the song counts frames at the engine rate, the export at the output rate
+        size_t song_frames = tempo_song_frames(&song->tempo);
+        size_t frames = state->sample_rate / VIDEO_FPS;
+        size_t song_left = (song_frames - state->playback_frame_counter + state->oversampling - 1) / state->oversampling;
+        if (frames > song_left) frames = song_left;
+        audio_callback(NULL, state->audio_buffer, NULL, frames);
+        frame_times_lap(&state->frame_times, PHASE_OTHER);
+        zone = trace_begin(&state->trace);
+        ok = ok && export_audio_write(frames);
+        if (ok && state->playback_frame_counter >= song_frames) ok = export_audio_tail();
+        trace_end(&state->trace, TRACE_THREAD_RENDER, "ffmpeg audio", zone);
+        encoder_queue = ffmpeg_queued_bytes(state->ffmpeg) + ffmpeg_queued_bytes(state->audio_ffmpeg);
+        trace_counter(&state->trace, TRACE_THREAD_RENDER, "encoder queue", encoder_queue);
+        frame_times_lap(&state->frame_times, PHASE_PIPE);
+
+        if (!ok || state->playback_frame_counter >= song_frames) {
+            ffmpeg_end_rendering(state->ffmpeg, !ok);
+            bool is_audio_written = ffmpeg_end_rendering(state->audio_ffmpeg, !ok) && ok;
             state->ffmpeg = NULL;
-        }
-
-        state->playback_frame_counter += SAMPLE_RATE / VIDEO_FPS;
-        if (state->playback_frame_counter >= state->settings_count * FRAMES_PER_SETTING) {
-            ffmpeg_end_rendering(state->ffmpeg, false);
+            state->audio_ffmpeg = NULL;
+
+            if (is_audio_written) {
+                loudness_report(&state->loudness);
+                if (state->normalize_export) {
+                    double gain = loudness_normalize_gain(&state->loudness, LOUDNESS_TARGET_LUFS, LIMITER_CEILING_DB);
+                    if (loudness_apply_gain("output.wav", gain)) printf("Normalized output.wav by %+.1f dB\n", gain);
+                }
+            }
+            msaa_unload(&state->export_msaa);
             SetTargetFPS(90);
+            audio_switch_sample_rate(state->device_sample_rate, 1);
+            song = atomic_load(&state->song);
         }
     }
 
-    DrawFPS(GetScreenWidth() - 100, GetScreenHeight() - 30);
+    if (state->show_frame_times) {
+        Rectangle area = { GetScreenWidth() - 520, 10, 510, 320 };
+        render_batch_reserve(&state->batch, 4 * PHASE_COUNT * FRAME_HISTORY + 64, 32);
+        frame_times_draw(&state->frame_times, area, encoder_queue);
+
+        BatchStats batch_stats = state->batch.last_frame;
+        sprintf(text, "batch: %d flushes, %d draw calls, %d vertices",
+                batch_stats.flushes, batch_stats.draw_calls, batch_stats.vertices);
+        DrawText(text, area.x + 8, area.y + area.height - 24, 16, WHITE);
+    } else {
+        frame_times_draw_summary(&state->frame_times, GetScreenWidth() - 100, GetScreenHeight() - 30);
+    }
+    render_batch_flush(&state->batch);
+    render_batch_end_frame(&state->batch);
+    frame_times_lap(&state->frame_times, PHASE_OTHER);
+    zone = trace_begin(&state->trace);
     EndDrawing();
+    trace_end(&state->trace, TRACE_THREAD_RENDER, "EndDrawing", zone);
+    frame_times_lap(&state->frame_times, PHASE_SWAP);
+    frame_times_end(&state->frame_times);
+    trace_end(&state->trace, TRACE_THREAD_RENDER, "plug_update", update_zone);
 }
 
@@ -0,0 +1,134 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Polyphonic tracks play every note of their steps on a voice of their own
+// pool. A step holds a note and up to three more as intervals of a chord,
+// when the step starts its notes are compared with the ones held: new notes
+// take a voice, notes that are gone are released and ring out.
+//
+// The pool is a fixed array of every voice field, one field after another,
+// and a packed list of the live voices. Rendering walks the list only, so a
+// track costs as many voices as are sounding, and a voice that has rung out
+// is swapped out of the list. Nothing is allocated while rendering.
+
+#define VOICE_POOL_CAPACITY SONG_MAX_VOICES
+#define VOICE_ATTACK_SECONDS 0.005f
+#define VOICE_SILENCE 1e-4f // -80 dB, a released voice is freed under it
+#define VOICE_MAX_NOTES 4   // per step, a note and a chord of three
+
+typedef struct {
+    uint32_t phases[GRAPH_MAX_NODES][VOICE_POOL_CAPACITY];
+    float frequency[VOICE_POOL_CAPACITY];
+    float level[VOICE_POOL_CAPACITY];       // envelope, 0 is a free voice
+    uint32_t started[VOICE_POOL_CAPACITY];  // note on order, oldest is stolen first
+    bool is_held[VOICE_POOL_CAPACITY];
+    uint8_t active[VOICE_POOL_CAPACITY];    // live voices
+    size_t active_count;
+    uint32_t note_counter;
+    size_t step;                            // position + 1 of the notes held, 0 before the first
+} VoicePool;
+
+// Frequencies of the notes of a step, the chord is in semitones over the note.
+size_t voice_step_notes(const Setting *setting, float *notes) {
+    if (setting->wave1 <= 0) return 0;
+    size_t count = 0;
+    notes[count++] = setting->wave1;
+    for (size_t i = 0; i < VOICE_MAX_NOTES - 1; i++) {
+        if (setting->chord[i] != 0) notes[count++] = setting->wave1 * exp2f(setting->chord[i] / 12.0f);
+    }
+    return count;
+}
+
+static bool voice_same_note(float a, float b) {
+    return fabsf(a - b) <= 1e-4f * b;
+}
+
+// Free voice, or the one that is missed least: the quietest released voice,
+// otherwise the oldest held one.
+static size_t voice_pool_take(VoicePool *pool, size_t polyphony) {
+    if (pool->active_count < polyphony) {
+        for (size_t v = 0; v < VOICE_POOL_CAPACITY; v++) {
+            if (pool->level[v] == 0 && !pool->is_held[v]) {
+                pool->active[pool->active_count++] = v;
+                return v;
+            }
+        }
+    }
+
+    size_t victim = pool->active[0];
+    for (size_t i = 1; i < pool->active_count; i++) {
+        size_t v = pool->active[i];
+        bool is_better = pool->is_held[victim] != pool->is_held[v]
+            ? !pool->is_held[v]
+            : pool->is_held[v] ? pool->started[v] < pool->started[victim] : pool->level[v] < pool->level[victim];
+        if (is_better) victim = v;
+    }
+    return victim;
+}
+
+// Starts and releases voices when a new step begins.
+void voice_pool_step(VoicePool *pool, size_t polyphony, const Setting *setting, size_t position) {
+    if (pool->step == position + 1) return;
+    pool->step = position + 1;
+    if (polyphony > VOICE_POOL_CAPACITY) polyphony = VOICE_POOL_CAPACITY;
+
+    float notes[VOICE_MAX_NOTES];
+    size_t note_count = voice_step_notes(setting, notes);
+    bool is_playing[VOICE_MAX_NOTES] = {0};
+
+    for (size_t i = 0; i < pool->active_count; i++) {
+        size_t v = pool->active[i];
+        if (!pool->is_held[v]) continue;
+
+        bool is_kept = false;
+        for (size_t n = 0; n < note_count && !is_kept; n++) {
+            if (!is_playing[n] && voice_same_note(pool->frequency[v], notes[n])) {
+                is_playing[n] = true;
+                is_kept = true;
+            }
+        }
+        pool->is_held[v] = is_kept;
+    }
+
+    for (size_t n = 0; n < note_count; n++) {
+        if (is_playing[n]) continue;
+        size_t v = voice_pool_take(pool, polyphony);
+        for (size_t node = 0; node < GRAPH_MAX_NODES; node++) pool->phases[node][v] = 0;
+        pool->frequency[v] = notes[n];
+        pool->level[v] = 0;
+        pool->started[v] = pool->note_counter++;
+        pool->is_held[v] = true;
+    }
+}
+
+// Adds count frames of a voice with its envelope to out. Returns false once
+// the voice has rung out.
+bool voice_pool_envelope(VoicePool *pool, size_t v, float release_seconds, float sample_rate,
+                         const float *signal, float *out, size_t count) {
+    float level = pool->level[v];
+    if (pool->is_held[v]) {
+        float attack = 1.0f / (VOICE_ATTACK_SECONDS * sample_rate);
+        for (size_t j = 0; j < count; j++) {
+            level = fminf(level + attack, 1);
+            out[j] += signal[j] * level;
+        }
+    } else {
+        float release = expf(logf(VOICE_SILENCE) / (fmaxf(release_seconds, 0.001f) * sample_rate));
+        for (size_t j = 0; j < count; j++) {
+            level *= release;
+            out[j] += signal[j] * level;
+        }
+    }
+    pool->level[v] = level;
+    return pool->is_held[v] || level >= VOICE_SILENCE;
+}
+
+// Drops the voice at index i of the live list, the last one takes its place.
+void voice_pool_free(VoicePool *pool, size_t i) {
+    size_t v = pool->active[i];
+    pool->level[v] = 0;
+    pool->is_held[v] = false;
+    pool->active[i] = pool->active[--pool->active_count];
+}
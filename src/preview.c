@@ -0,0 +1,90 @@
+#include <math.h>
+
+#include "raylib.h"
+
+// Live preview renders the frame into its own target, sized to the window
+// and scaled down further when frames take too long. The scale moves in
+// steps with separate thresholds and hold times for going down and up, so
+// it settles instead of flipping every frame. The target is stretched to
+// the window with bilinear filtering. Export never uses it.
+
+#define PREVIEW_TARGET_FRAME_TIME (1.0f / 60)
+#define PREVIEW_SLOW_FACTOR 1.1f     // scale down above this part of the target
+#define PREVIEW_FAST_FACTOR 0.7f     // scale up below it
+#define PREVIEW_SLOW_HOLD 0.5f       // seconds
+#define PREVIEW_FAST_HOLD 3.0f
+#define PREVIEW_SCALE_STEP 0.84f
+#define PREVIEW_MAX_LEVEL 8          // 0.84^8 is about a quarter
+
+typedef struct {
+    RenderTexture2D target;
+    int level;                 // scale is PREVIEW_SCALE_STEP^level
+    float average_work_time;
+    float slow_time;
+    float fast_time;
+} Preview;
+
+void preview_unload(Preview *preview) {
+    if (preview->target.id != 0) UnloadRenderTexture(preview->target);
+    preview->target = (RenderTexture2D) {0};
+}
+
+// Feeds the last frame to the scale controller. Work time is the frame
+// without waiting for vsync, which would hold it at the refresh period, the
+// frame time counts towards the hold times.
+void preview_update_scale(Preview *preview, float work_time, float frame_time) {
+    if (preview->average_work_time == 0) preview->average_work_time = work_time;
+    preview->average_work_time += (work_time - preview->average_work_time) * 0.1f;
+    float average = preview->average_work_time;
+
+    if (average > PREVIEW_TARGET_FRAME_TIME * PREVIEW_SLOW_FACTOR && preview->level < PREVIEW_MAX_LEVEL) {
+        preview->slow_time += frame_time;
+        preview->fast_time = 0;
+        if (preview->slow_time >= PREVIEW_SLOW_HOLD) {
+            preview->level++;
+            preview->slow_time = 0;
+        }
+    } else if (average < PREVIEW_TARGET_FRAME_TIME * PREVIEW_FAST_FACTOR && preview->level > 0) {
+        preview->fast_time += frame_time;
+        preview->slow_time = 0;
+        if (preview->fast_time >= PREVIEW_FAST_HOLD) {
+            preview->level--;
+            preview->fast_time = 0;
+        }
+    } else {
+        preview->slow_time = 0;
+        preview->fast_time = 0;
+    }
+}
+
+// Returns the target for this frame, recreated when its size changes. It
+// keeps the aspect of the output and is never larger than the output.
+RenderTexture2D *preview_target(Preview *preview, int window_width, int window_height, int output_width, int output_height) {
+    float fit = fminf((float)window_width / output_width, (float)window_height / output_height);
+    float scale = fminf(fit, 1) * powf(PREVIEW_SCALE_STEP, preview->level);
+    int width = (int)fmaxf(roundf(output_width * scale), 1);
+    int height = (int)fmaxf(roundf(output_height * scale), 1);
+
+    if (preview->target.id == 0 || preview->target.texture.width != width || preview->target.texture.height != height) {
+        preview_unload(preview);
+        preview->target = LoadRenderTexture(width, height);
+        SetTextureFilter(preview->target.texture, TEXTURE_FILTER_BILINEAR);
+    }
+    return &preview->target;
+}
+
+// Draws a render target into the window, as large as fits.
+void draw_target_fitted(const RenderTexture2D *target, int window_width, int window_height) {
+    float width = target->texture.width, height = target->texture.height;
+    float fit = fminf(window_width / width, window_height / height);
+    Rectangle destination = {
+        (window_width - width * fit) / 2,
+        (window_height - height * fit) / 2,
+        width * fit,
+        height * fit,
+    };
+
+    // render textures are stored upside down
+    Rectangle source = { 0, 0, width, -height };
+    DrawTexturePro(target->texture, source, destination, (Vector2) {0}, 0, WHITE);
+}
@@ -0,0 +1,77 @@
+#include <math.h>
+#include <string.h>
+
+#include "simd.h"
+
+// Oversampled rendering runs the engine at twice the output rate, so the
+// oscillators alias far above the audible band, and brings it down with a
+// halfband decimator. A halfband lowpass has every other tap at 0 except the
+// center, so as two polyphase branches the odd input samples only need the
+// center tap and the even ones take the rest, at the output rate.
+//
+// Taps are a Kaiser windowed sinc, flat to about 0.21 of the input rate and
+// around -100 dB from 0.29 on. Histories are rings written twice, so the
+// branch always reads one run of samples.
+
+#define DECIMATOR_TAPS 79                          // 4k + 3, first and last are not 0
+#define DECIMATOR_BRANCH ((DECIMATOR_TAPS + 1) / 2) // taps on the even samples
+#define DECIMATOR_RING 64
+#define DECIMATOR_KAISER_BETA 10.0
+#define DECIMATOR_LATENCY ((DECIMATOR_TAPS / 2 + 1) / 2) // output frames, rounded up
+
+typedef struct {
+    float branch[DECIMATOR_BRANCH];
+    float even[NUMBER_OF_CHANNELS][2 * DECIMATOR_RING];
+    float odd[NUMBER_OF_CHANNELS][2 * DECIMATOR_RING];
+    size_t cursor;
+} Decimator;
+
+static double decimator_bessel_i0(double x) {
+    double sum = 1, term = 1;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+void decimator_init(Decimator *decimator) {
+    memset(decimator, 0, sizeof(*decimator));
+
+    int center = DECIMATOR_TAPS / 2;
+    double sum = 0;
+    for (int i = 0; i < DECIMATOR_BRANCH; i++) {
+        int n = 2 * i - center; // odd, the even offsets of a halfband are 0
+        double r = (double)n / center;
+        double window = decimator_bessel_i0(DECIMATOR_KAISER_BETA * sqrt(1 - r * r))
+                      / decimator_bessel_i0(DECIMATOR_KAISER_BETA);
+        double tap = sin(M_PI * n / 2) / (M_PI * n) * window;
+        decimator->branch[i] = tap;
+        sum += tap;
+    }
+
+    // with the center tap of 0.5 the gain at 0 Hz is exactly 1
+    for (int i = 0; i < DECIMATOR_BRANCH; i++) decimator->branch[i] *= 0.5 / sum;
+}
+
+// Turns 2 * frames_count interleaved input frames into frames_count output
+// frames, which are DECIMATOR_LATENCY frames late.
+void decimator_process(Decimator *decimator, const float *input, float *output, size_t frames_count) {
+    size_t cursor = decimator->cursor;
+    for (size_t i = 0; i < frames_count; i++, cursor = (cursor + 1) & (DECIMATOR_RING - 1)) {
+        for (size_t c = 0; c < NUMBER_OF_CHANNELS; c++) {
+            float *even = decimator->even[c], *odd = decimator->odd[c];
+            even[cursor] = even[cursor + DECIMATOR_RING] = input[(2 * i) * NUMBER_OF_CHANNELS + c];
+            odd[cursor] = odd[cursor + DECIMATOR_RING] = input[(2 * i + 1) * NUMBER_OF_CHANNELS + c];
+
+            const float *history = even + cursor + DECIMATOR_RING - (DECIMATOR_BRANCH - 1);
+            f32x4 sum = f32x4_splat(0);
+            for (size_t k = 0; k < DECIMATOR_BRANCH; k += 4) {
+                sum += f32x4_load(decimator->branch + k) * f32x4_load(history + k);
+            }
+            float center = odd[cursor + DECIMATOR_RING - DECIMATOR_BRANCH / 2];
+            output[i * NUMBER_OF_CHANNELS + c] = sum[0] + sum[1] + sum[2] + sum[3] + 0.5f * center;
+        }
+    }
+    decimator->cursor = cursor;
+}
@@ -0,0 +1,71 @@
+#ifndef SIMD_H_
+#define SIMD_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+// 4 lane vectors through compiler vector extensions, lowered to SSE on x86
+// and NEON on arm64. Loads and stores are unaligned.
+
+typedef float f32x4 __attribute__((vector_size(16)));
+typedef int32_t i32x4 __attribute__((vector_size(16)));
+
+#define F32X4_IOTA ((f32x4) { 0, 1, 2, 3 })
+
+static inline f32x4 f32x4_splat(float value) {
+    return (f32x4) { value, value, value, value };
+}
+
+static inline f32x4 f32x4_load(const float *source) {
+    f32x4 result;
+    memcpy(&result, source, sizeof(result));
+    return result;
+}
+
+static inline void f32x4_store(float *destination, f32x4 value) {
+    memcpy(destination, &value, sizeof(value));
+}
+
+// a0 b0 a1 b1
+static inline f32x4 f32x4_interleave_low(f32x4 a, f32x4 b) {
+    return __builtin_shufflevector(a, b, 0, 4, 1, 5);
+}
+
+// a2 b2 a3 b3
+static inline f32x4 f32x4_interleave_high(f32x4 a, f32x4 b) {
+    return __builtin_shufflevector(a, b, 2, 6, 3, 7);
+}
+
+// Flushes denormals to zero on this thread until the returned mode is
+// restored. Filters and feedback loops that decay towards zero would
+// otherwise spend many cycles on every operation near the end.
+static inline uint64_t simd_flush_denormals(void) {
+#if defined(__SSE__)
+    uint64_t mode = _mm_getcsr();
+    _mm_setcsr(mode | 0x8040); // flush to zero, denormals are zero
+    return mode;
+#elif defined(__aarch64__)
+    uint64_t mode;
+    __asm__ volatile("mrs %0, fpcr" : "=r"(mode));
+    __asm__ volatile("msr fpcr, %0" : : "r"(mode | (1 << 24)));
+    return mode;
+#else
+    return 0;
+#endif
+}
+
+static inline void simd_restore_denormals(uint64_t mode) {
+#if defined(__SSE__)
+    _mm_setcsr((unsigned int)mode);
+#elif defined(__aarch64__)
+    __asm__ volatile("msr fpcr, %0" : : "r"(mode));
+#else
+    (void)mode;
+#endif
+}
+
+#endif // SIMD_H_
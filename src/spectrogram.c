@@ -0,0 +1,77 @@
+#include <stdint.h>
+
+#include "raylib.h"
+
+// Spectrogram is a ring of columns in one texture, a column per published
+// spectrum. Only the newest column is uploaded, drawing starts the texture
+// at the oldest column and lets the repeat wrap mode bring the rest around,
+// so the cost per frame does not depend on how much history is shown.
+
+#define SPECTROGRAM_COLUMNS 512
+
+typedef struct {
+    Texture2D texture;
+    size_t cursor;         // next column to write
+    uint64_t last_frame;   // frame of the last spectrum written
+} Spectrogram;
+
+void spectrogram_load(Spectrogram *spectrogram) {
+    Image image = GenImageColor(SPECTROGRAM_COLUMNS, SPECTRUM_BANDS, BLACK);
+    spectrogram->texture = LoadTextureFromImage(image);
+    UnloadImage(image);
+
+    SetTextureWrap(spectrogram->texture, TEXTURE_WRAP_REPEAT);
+    SetTextureFilter(spectrogram->texture, TEXTURE_FILTER_POINT);
+    spectrogram->cursor = 0;
+    spectrogram->last_frame = UINT64_MAX;
+}
+
+void spectrogram_unload(Spectrogram *spectrogram) {
+    UnloadTexture(spectrogram->texture);
+    spectrogram->texture = (Texture2D) {0};
+}
+
+// black, blue, red, yellow, white
+static Color spectrogram_color(float level) {
+    static const Color stops[] = {
+        {   0,   0,   0, 255 },
+        {  20,  20, 160, 255 },
+        { 220,  30,  60, 255 },
+        { 250, 220,  40, 255 },
+        { 255, 255, 255, 255 },
+    };
+    float position = level * (sizeof(stops) / sizeof(stops[0]) - 1);
+    size_t index = (size_t)position;
+    if (index >= sizeof(stops) / sizeof(stops[0]) - 1) return stops[index];
+
+    float t = position - index;
+    Color a = stops[index], b = stops[index + 1];
+    return (Color) {
+        a.r + (b.r - a.r) * t,
+        a.g + (b.g - a.g) * t,
+        a.b + (b.b - a.b) * t,
+        255,
+    };
+}
+
+// Appends a column if the spectrum is new.
+void spectrogram_push(Spectrogram *spectrogram, const Spectrum *spectrum, size_t channel) {
+    if (spectrum->channel_count <= channel || spectrum->frame == spectrogram->last_frame) return;
+    spectrogram->last_frame = spectrum->frame;
+
+    // low frequencies at the bottom
+    Color column[SPECTRUM_BANDS];
+    for (size_t b = 0; b < SPECTRUM_BANDS; b++) {
+        column[SPECTRUM_BANDS - 1 - b] = spectrogram_color(spectrum->bands[channel][b]);
+    }
+
+    Rectangle rectangle = { spectrogram->cursor, 0, 1, SPECTRUM_BANDS };
+    UpdateTextureRec(spectrogram->texture, rectangle, column);
+    spectrogram->cursor = (spectrogram->cursor + 1) % SPECTROGRAM_COLUMNS;
+}
+
+// Oldest column on the left, newest on the right.
+void spectrogram_draw(const Spectrogram *spectrogram, Rectangle destination, Color tint) {
+    Rectangle source = { spectrogram->cursor, 0, SPECTROGRAM_COLUMNS, SPECTRUM_BANDS };
+    DrawTexturePro(spectrogram->texture, source, destination, (Vector2) {0}, 0, tint);
+}
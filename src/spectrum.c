@@ -0,0 +1,303 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "simd.h"
+
+// Spectrum analyzer. The render thread copies the newest window of every tap
+// channel into the analyzer and a worker thread turns it into log spaced,
+// smoothed bands. All tables and buffers live inside of Analyzer, nothing
+// is allocated after spectrum_init.
+//
+// A real FFT of SPECTRUM_SIZE points is done as a complex FFT of half the
+// size over the even and odd samples, which is then split into the real
+// spectrum. Butterflies of the complex FFT are done four at a time.
+//
+// Results are double buffered. The worker only writes the back buffer while
+// it handles a request and the render thread only submits a request after it
+// is done reading, so the front buffer is never written while it is read.
+
+#define SPECTRUM_SIZE 2048
+#define SPECTRUM_HALF (SPECTRUM_SIZE / 2)
+#define SPECTRUM_BANDS 64
+#define SPECTRUM_MIN_FREQUENCY 30.0
+#define SPECTRUM_MAX_FREQUENCY 16000.0
+#define SPECTRUM_FLOOR_DB -72.0f
+#define SPECTRUM_RELEASE_SECONDS 0.25f
+
+typedef struct {
+    float bands[TAP_CHANNELS][SPECTRUM_BANDS]; // 0..1
+    size_t channel_count;
+    uint64_t frame; // playback frame at the end of the window
+} Spectrum;
+
+typedef struct {
+    float window[SPECTRUM_SIZE];
+    uint16_t bit_reverse[SPECTRUM_HALF];
+    float stage_re[SPECTRUM_HALF];   // butterfly twiddles of stage h at h - 1
+    float stage_im[SPECTRUM_HALF];
+    float split_re[SPECTRUM_HALF];   // e^(-2 pi i k / SPECTRUM_SIZE)
+    float split_im[SPECTRUM_HALF];
+    uint16_t band_first[SPECTRUM_BANDS];
+    uint16_t band_last[SPECTRUM_BANDS];
+
+    // owned by the worker while a request is handled
+    float re[SPECTRUM_HALF];
+    float im[SPECTRUM_HALF];
+    float magnitudes[SPECTRUM_HALF + 1];
+    float smoothed[TAP_CHANNELS][SPECTRUM_BANDS];
+    float input[TAP_CHANNELS][SPECTRUM_SIZE];
+    size_t input_channels;
+    uint64_t input_frame;
+    float input_delta_time;
+
+    Spectrum spectra[2];
+    _Atomic(int) front;
+
+    pthread_mutex_t lock;
+    pthread_cond_t condition;
+    bool has_request;
+    bool is_worker_running;
+    pthread_t worker;
+} Analyzer;
+
+// Bands are spaced evenly in log frequency, a band narrower than one FFT bin
+// takes the nearest bin.
+static void spectrum_map_bands(Analyzer *analyzer, size_t sample_rate) {
+    double bin_width = (double)sample_rate / SPECTRUM_SIZE;
+    double ratio = SPECTRUM_MAX_FREQUENCY / SPECTRUM_MIN_FREQUENCY;
+    for (size_t b = 0; b < SPECTRUM_BANDS; b++) {
+        double low = SPECTRUM_MIN_FREQUENCY * pow(ratio, (double)b / SPECTRUM_BANDS) / bin_width;
+        double high = SPECTRUM_MIN_FREQUENCY * pow(ratio, (double)(b + 1) / SPECTRUM_BANDS) / bin_width;
+        size_t first = (size_t)ceil(low), last = (size_t)floor(high);
+        if (first > last) first = last = (size_t)round(sqrt(low * high));
+        if (last > SPECTRUM_HALF) last = SPECTRUM_HALF;
+        if (first > last) first = last;
+        analyzer->band_first[b] = first;
+        analyzer->band_last[b] = last;
+    }
+}
+
+void spectrum_init(Analyzer *analyzer, size_t sample_rate) {
+    for (size_t n = 0; n < SPECTRUM_SIZE; n++) {
+        analyzer->window[n] = 0.5 - 0.5 * cos(2 * PI * n / SPECTRUM_SIZE);
+    }
+
+    size_t bits = 0;
+    while ((1u << bits) < SPECTRUM_HALF) bits++;
+    for (size_t n = 0; n < SPECTRUM_HALF; n++) {
+        size_t reversed = 0;
+        for (size_t b = 0; b < bits; b++) reversed |= ((n >> b) & 1) << (bits - 1 - b);
+        analyzer->bit_reverse[n] = reversed;
+    }
+
+    for (size_t h = 1; h < SPECTRUM_HALF; h *= 2) {
+        for (size_t k = 0; k < h; k++) {
+            analyzer->stage_re[h - 1 + k] = cos(-PI * k / h);
+            analyzer->stage_im[h - 1 + k] = sin(-PI * k / h);
+        }
+    }
+
+    for (size_t k = 0; k < SPECTRUM_HALF; k++) {
+        analyzer->split_re[k] = cos(-2 * PI * k / SPECTRUM_SIZE);
+        analyzer->split_im[k] = sin(-2 * PI * k / SPECTRUM_SIZE);
+    }
+
+    spectrum_map_bands(analyzer, sample_rate);
+
+    pthread_mutex_init(&analyzer->lock, NULL);
+    pthread_cond_init(&analyzer->condition, NULL);
+}
+
+// The tap changed its rate. Waits for the worker to finish the window it has.
+void spectrum_set_sample_rate(Analyzer *analyzer, size_t sample_rate) {
+    pthread_mutex_lock(&analyzer->lock);
+    while (analyzer->is_worker_running && analyzer->has_request) {
+        pthread_cond_wait(&analyzer->condition, &analyzer->lock);
+    }
+    spectrum_map_bands(analyzer, sample_rate);
+    pthread_mutex_unlock(&analyzer->lock);
+}
+
+void spectrum_free(Analyzer *analyzer) {
+    pthread_mutex_destroy(&analyzer->lock);
+    pthread_cond_destroy(&analyzer->condition);
+}
+
+static void spectrum_fft(Analyzer *analyzer) {
+    float *re = analyzer->re, *im = analyzer->im;
+
+    // first two stages have less than four butterflies per group
+    for (size_t h = 1; h < 4; h *= 2) {
+        for (size_t start = 0; start < SPECTRUM_HALF; start += 2 * h) {
+            for (size_t k = 0; k < h; k++) {
+                float wr = analyzer->stage_re[h - 1 + k], wi = analyzer->stage_im[h - 1 + k];
+                size_t a = start + k, b = start + k + h;
+                float tr = re[b] * wr - im[b] * wi;
+                float ti = re[b] * wi + im[b] * wr;
+                re[b] = re[a] - tr; im[b] = im[a] - ti;
+                re[a] = re[a] + tr; im[a] = im[a] + ti;
+            }
+        }
+    }
+
+    for (size_t h = 4; h < SPECTRUM_HALF; h *= 2) {
+        for (size_t start = 0; start < SPECTRUM_HALF; start += 2 * h) {
+            for (size_t k = 0; k < h; k += 4) {
+                f32x4 wr = f32x4_load(analyzer->stage_re + h - 1 + k);
+                f32x4 wi = f32x4_load(analyzer->stage_im + h - 1 + k);
+                float *ar = re + start + k, *ai = im + start + k;
+                float *br = ar + h, *bi = ai + h;
+
+                f32x4 xr = f32x4_load(ar), xi = f32x4_load(ai);
+                f32x4 yr = f32x4_load(br), yi = f32x4_load(bi);
+                f32x4 tr = yr * wr - yi * wi;
+                f32x4 ti = yr * wi + yi * wr;
+                f32x4_store(ar, xr + tr); f32x4_store(ai, xi + ti);
+                f32x4_store(br, xr - tr); f32x4_store(bi, xi - ti);
+            }
+        }
+    }
+}
+
+// Fills magnitudes of bins 0..SPECTRUM_HALF as amplitudes of the input.
+static void spectrum_real_fft(Analyzer *analyzer, const float *samples) {
+    for (size_t n = 0; n < SPECTRUM_HALF; n++) {
+        size_t r = analyzer->bit_reverse[n];
+        analyzer->re[r] = samples[2 * n] * analyzer->window[2 * n];
+        analyzer->im[r] = samples[2 * n + 1] * analyzer->window[2 * n + 1];
+    }
+
+    spectrum_fft(analyzer);
+
+    // Hann window halves the amplitude, a full scale sine peaks at 1
+    const float scale = 2.0f / SPECTRUM_HALF;
+    for (size_t k = 0; k <= SPECTRUM_HALF; k++) {
+        size_t a = k % SPECTRUM_HALF, b = (SPECTRUM_HALF - k) % SPECTRUM_HALF;
+        float zr = analyzer->re[a], zi = analyzer->im[a];
+        float cr = analyzer->re[b], ci = -analyzer->im[b];
+
+        float even_r = 0.5f * (zr + cr), even_i = 0.5f * (zi + ci);
+        float odd_r = 0.5f * (zi - ci), odd_i = -0.5f * (zr - cr);
+
+        float wr = k < SPECTRUM_HALF ? analyzer->split_re[k] : -1;
+        float wi = k < SPECTRUM_HALF ? analyzer->split_im[k] : 0;
+        float xr = even_r + odd_r * wr - odd_i * wi;
+        float xi = even_i + odd_r * wi + odd_i * wr;
+        analyzer->magnitudes[k] = sqrtf(xr * xr + xi * xi) * scale;
+    }
+}
+
+static void spectrum_analyze(Analyzer *analyzer) {
+    Spectrum *back = &analyzer->spectra[1 - atomic_load(&analyzer->front)];
+    float release = expf(-analyzer->input_delta_time / SPECTRUM_RELEASE_SECONDS);
+
+    for (size_t c = 0; c < analyzer->input_channels; c++) {
+        spectrum_real_fft(analyzer, analyzer->input[c]);
+
+        for (size_t b = 0; b < SPECTRUM_BANDS; b++) {
+            float peak = 0;
+            for (size_t k = analyzer->band_first[b]; k <= analyzer->band_last[b]; k++) {
+                peak = fmaxf(peak, analyzer->magnitudes[k]);
+            }
+            float level = (20 * log10f(peak + 1e-9f) - SPECTRUM_FLOOR_DB) / -SPECTRUM_FLOOR_DB;
+            level = fminf(fmaxf(level, 0), 1);
+
+            // rise at once, fall slowly
+            float *smoothed = &analyzer->smoothed[c][b];
+            *smoothed = fmaxf(level, *smoothed * release);
+            back->bands[c][b] = *smoothed;
+        }
+    }
+
+    back->channel_count = analyzer->input_channels;
+    back->frame = analyzer->input_frame;
+    atomic_store(&analyzer->front, 1 - atomic_load(&analyzer->front));
+}
+
+static void *spectrum_worker(void *argument) {
+    Analyzer *analyzer = argument;
+    pthread_mutex_lock(&analyzer->lock);
+    while (true) {
+        while (analyzer->is_worker_running && !analyzer->has_request) {
+            pthread_cond_wait(&analyzer->condition, &analyzer->lock);
+        }
+        if (!analyzer->is_worker_running) break;
+        pthread_mutex_unlock(&analyzer->lock);
+
+        spectrum_analyze(analyzer);
+
+        pthread_mutex_lock(&analyzer->lock);
+        analyzer->has_request = false;
+        pthread_cond_broadcast(&analyzer->condition);
+    }
+    pthread_mutex_unlock(&analyzer->lock);
+    return NULL;
+}
+
+void spectrum_start_worker(Analyzer *analyzer) {
+    pthread_mutex_lock(&analyzer->lock);
+    analyzer->is_worker_running = true;
+    pthread_mutex_unlock(&analyzer->lock);
+
+    if (pthread_create(&analyzer->worker, NULL, spectrum_worker, analyzer) != 0) {
+        printf("spectrum.c: spectrum_start_worker: Error: could not create thread\n");
+        analyzer->is_worker_running = false;
+    }
+}
+
+// Must be called before the plugin is unloaded, the worker runs plugin code.
+void spectrum_stop_worker(Analyzer *analyzer) {
+    pthread_mutex_lock(&analyzer->lock);
+    bool was_running = analyzer->is_worker_running;
+    analyzer->is_worker_running = false;
+    analyzer->has_request = false;
+    pthread_cond_broadcast(&analyzer->condition);
+    pthread_mutex_unlock(&analyzer->lock);
+
+    if (was_running) pthread_join(analyzer->worker, NULL);
+}
+
+// Hands the window of history that ends at the frame to the worker. Skipped
+// if the worker is still busy with the previous one. With wait the caller
+// blocks until the spectrum is published, so exports see every window.
+void spectrum_submit(Analyzer *analyzer, const TapHistory *history, uint64_t end_frame, float delta_time, bool wait) {
+    pthread_mutex_lock(&analyzer->lock);
+    if (analyzer->has_request) {
+        pthread_mutex_unlock(&analyzer->lock);
+        return;
+    }
+
+    analyzer->input_channels = 1 + history->track_count;
+    for (size_t c = 0; c < analyzer->input_channels; c++) {
+        tap_history_read(history, c, end_frame, analyzer->input[c], SPECTRUM_SIZE);
+    }
+    analyzer->input_frame = end_frame;
+    analyzer->input_delta_time = delta_time;
+
+    if (!analyzer->is_worker_running) {
+        pthread_mutex_unlock(&analyzer->lock);
+        spectrum_analyze(analyzer);
+        return;
+    }
+
+    analyzer->has_request = true;
+    pthread_cond_broadcast(&analyzer->condition);
+    pthread_mutex_unlock(&analyzer->lock);
+
+    if (wait) {
+        pthread_mutex_lock(&analyzer->lock);
+        while (analyzer->is_worker_running && analyzer->has_request) {
+            pthread_cond_wait(&analyzer->condition, &analyzer->lock);
+        }
+        pthread_mutex_unlock(&analyzer->lock);
+    }
+}
+
+const Spectrum *spectrum_latest(const Analyzer *analyzer) {
+    return &analyzer->spectra[atomic_load(&analyzer->front)];
+}
@@ -0,0 +1,254 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Stems export renders the song once and writes the mix and every track
+// into its own file, as the song has them, without the mixer. A worker
+// renders chunks, every output has a writer thread with a small queue of
+// chunks feeding its ffmpeg, so one slow encoder does not hold up the others
+// until its queue is full.
+//
+// The worker runs plugin code and reads the song, it has to be stopped
+// before the plugin unloads and before the song is unmapped.
+
+#define STEMS_MAX_TRACKS 16
+#define STEMS_CHUNK_FRAMES 8192
+#define STEMS_QUEUE_CHUNKS 4
+
+typedef struct {
+    FFMPEG *ffmpeg;
+    size_t channels;
+    float *chunks;                     // STEMS_QUEUE_CHUNKS chunks of interleaved frames
+    size_t frames[STEMS_QUEUE_CHUNKS];
+    size_t write;                      // chunks queued, guarded by mutex
+    size_t read;
+    bool is_closed;                    // no more chunks will come
+    bool is_cancelled;                 // queued chunks are dropped
+    bool is_failed;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    pthread_t thread;
+} StemWriter;
+
+typedef struct {
+    StemWriter writers[1 + STEMS_MAX_TRACKS]; // mix first
+    size_t writer_count;
+
+    Song *song; // NULL if there is no export
+    uint64_t song_frames;
+    TrackState tracks[SONG_MAX_TRACKS];
+    float *mix;   // interleaved, a chunk
+    float *stems; // planar, a chunk per track
+
+    _Atomic(bool) is_worker_running; // cleared to cancel
+    _Atomic(bool) is_finished;       // worker is done and can be joined
+    _Atomic(uint64_t) rendered_frames;
+    pthread_t worker;
+} StemsExport;
+
+static void stems_release(StemsExport *export) {
+    free(export->mix);
+    free(export->stems);
+    export->mix = NULL;
+    export->stems = NULL;
+    export->song = NULL;
+}
+
+static void *stem_writer_thread(void *argument) {
+    StemWriter *writer = argument;
+
+    pthread_mutex_lock(&writer->mutex);
+    for (;;) {
+        while (writer->read == writer->write && !writer->is_closed) {
+            pthread_cond_wait(&writer->changed, &writer->mutex);
+        }
+        if (writer->read == writer->write || writer->is_cancelled) break;
+
+        // the chunk belongs to this thread until read moves past it
+        size_t slot = writer->read % STEMS_QUEUE_CHUNKS;
+        pthread_mutex_unlock(&writer->mutex);
+
+        float *chunk = writer->chunks + slot * STEMS_CHUNK_FRAMES * writer->channels;
+        size_t size = writer->frames[slot] * writer->channels * sizeof(float);
+        bool ok = ffmpeg_send_sound_samples(writer->ffmpeg, chunk, size);
+
+        pthread_mutex_lock(&writer->mutex);
+        if (!ok) writer->is_failed = true;
+        writer->read++;
+        pthread_cond_broadcast(&writer->changed);
+    }
+    pthread_mutex_unlock(&writer->mutex);
+    return NULL;
+}
+
+static bool stem_writer_open(StemWriter *writer, const char *path, size_t channels, size_t sample_rate) {
+    *writer = (StemWriter) { .channels = channels };
+    writer->ffmpeg = ffmpeg_start_rendering_audio(path, channels, sample_rate);
+    if (writer->ffmpeg == NULL) return false;
+
+    writer->chunks = malloc(STEMS_QUEUE_CHUNKS * STEMS_CHUNK_FRAMES * channels * sizeof(float));
+    assert(writer->chunks != NULL && "Buy MORE RAM lol!!");
+    pthread_mutex_init(&writer->mutex, NULL);
+    pthread_cond_init(&writer->changed, NULL);
+
+    if (pthread_create(&writer->thread, NULL, stem_writer_thread, writer) != 0) {
+        printf("stems.c: stem_writer_open: Error: could not create thread\n");
+        ffmpeg_end_rendering(writer->ffmpeg, true);
+        free(writer->chunks);
+        pthread_mutex_destroy(&writer->mutex);
+        pthread_cond_destroy(&writer->changed);
+        *writer = (StemWriter) {0};
+        return false;
+    }
+    return true;
+}
+
+// Returns false if the writer failed.
+static bool stem_writer_push(StemWriter *writer, const float *samples, size_t frames) {
+    pthread_mutex_lock(&writer->mutex);
+    while (writer->write - writer->read == STEMS_QUEUE_CHUNKS && !writer->is_failed) {
+        pthread_cond_wait(&writer->changed, &writer->mutex);
+    }
+    bool is_failed = writer->is_failed;
+    pthread_mutex_unlock(&writer->mutex);
+    if (is_failed) return false;
+
+    // the slot is free, only this thread writes into free slots
+    size_t slot = writer->write % STEMS_QUEUE_CHUNKS;
+    memcpy(writer->chunks + slot * STEMS_CHUNK_FRAMES * writer->channels, samples, frames * writer->channels * sizeof(float));
+    writer->frames[slot] = frames;
+
+    pthread_mutex_lock(&writer->mutex);
+    writer->write++;
+    pthread_cond_broadcast(&writer->changed);
+    pthread_mutex_unlock(&writer->mutex);
+    return true;
+}
+
+// Waits for the queued chunks, unless cancelled, and finishes the file.
+static bool stem_writer_close(StemWriter *writer, bool cancel) {
+    pthread_mutex_lock(&writer->mutex);
+    writer->is_cancelled = cancel;
+    writer->is_closed = true;
+    pthread_cond_broadcast(&writer->changed);
+    pthread_mutex_unlock(&writer->mutex);
+
+    // ffmpeg keeps reading until it is ended, a write in progress finishes
+    pthread_join(writer->thread, NULL);
+    bool ok = ffmpeg_end_rendering(writer->ffmpeg, cancel || writer->is_failed) && !writer->is_failed;
+
+    free(writer->chunks);
+    pthread_mutex_destroy(&writer->mutex);
+    pthread_cond_destroy(&writer->changed);
+    *writer = (StemWriter) {0};
+    return ok && !cancel;
+}
+
+static void *stems_worker(void *argument) {
+    StemsExport *export = argument;
+    Song *song = export->song;
+    size_t track_count = export->writer_count - 1;
+    bool ok = true;
+    simd_flush_denormals();
+
+    uint64_t frame = 0;
+    while (ok && frame < export->song_frames && atomic_load(&export->is_worker_running)) {
+        size_t frames = STEMS_CHUNK_FRAMES;
+        if (frames > export->song_frames - frame) frames = export->song_frames - frame;
+
+        render_song(song, export->tracks, frame, export->mix, frames, STEP_READER_STEMS, true, NULL, export->stems, NULL);
+
+        ok = stem_writer_push(&export->writers[0], export->mix, frames);
+        for (size_t t = 0; ok && t < track_count; t++) {
+            ok = stem_writer_push(&export->writers[1 + t], export->stems + t * frames, frames);
+        }
+        frame += frames;
+        atomic_store(&export->rendered_frames, frame);
+    }
+
+    bool cancel = !ok || frame < export->song_frames;
+    for (size_t w = 0; w < export->writer_count; w++) {
+        ok = stem_writer_close(&export->writers[w], cancel) && ok;
+    }
+    export->writer_count = 0;
+
+    if (cancel) {
+        printf("stems.c: stems_worker: Error: stems export did not finish\n");
+    } else {
+        printf("Stems written: mix and %zu tracks\n", track_count);
+    }
+    atomic_store(&export->is_finished, true);
+    return NULL;
+}
+
+// Starts writing the mix into <prefix>_mix<extension> and every track into
+// <prefix>_<n><extension>, extension is ".wav" or ".flac".
+bool stems_start(StemsExport *export, Song *song, const char *prefix, const char *extension) {
+    if (export->song != NULL) return false;
+
+    size_t track_count = song->track_count;
+    if (track_count > STEMS_MAX_TRACKS) {
+        printf("stems.c: stems_start: Error: only the first %d of %zu tracks get a stem\n", STEMS_MAX_TRACKS, track_count);
+        track_count = STEMS_MAX_TRACKS;
+    }
+
+    // stems come out at the rate the song is mapped at
+    size_t sample_rate = song->tempo.sample_rate;
+    char path[256];
+    snprintf(path, sizeof(path), "%s_mix%s", prefix, extension);
+    bool ok = stem_writer_open(&export->writers[0], path, NUMBER_OF_CHANNELS, sample_rate);
+    export->writer_count = ok ? 1 : 0;
+    for (size_t t = 0; ok && t < track_count; t++) {
+        snprintf(path, sizeof(path), "%s_%zu%s", prefix, t + 1, extension);
+        ok = stem_writer_open(&export->writers[1 + t], path, 1, sample_rate);
+        if (ok) export->writer_count++;
+    }
+
+    if (!ok) {
+        for (size_t w = 0; w < export->writer_count; w++) stem_writer_close(&export->writers[w], true);
+        export->writer_count = 0;
+        return false;
+    }
+
+    export->mix = malloc(STEMS_CHUNK_FRAMES * NUMBER_OF_CHANNELS * sizeof(float));
+    export->stems = malloc(STEMS_CHUNK_FRAMES * (song->track_count + 1) * sizeof(float));
+    assert(export->mix != NULL && export->stems != NULL && "Buy MORE RAM lol!!");
+
+    export->song = song;
+    export->song_frames = tempo_song_frames(&song->tempo);
+    memset(export->tracks, 0, sizeof(export->tracks));
+    atomic_store(&export->rendered_frames, 0);
+    atomic_store(&export->is_finished, false);
+    atomic_store(&export->is_worker_running, true);
+
+    if (pthread_create(&export->worker, NULL, stems_worker, export) != 0) {
+        printf("stems.c: stems_start: Error: could not create thread\n");
+        atomic_store(&export->is_worker_running, false);
+        for (size_t w = 0; w < export->writer_count; w++) stem_writer_close(&export->writers[w], true);
+        export->writer_count = 0;
+        stems_release(export);
+        return false;
+    }
+    return true;
+}
+
+// Joins the worker once it is done, call every frame.
+void stems_update(StemsExport *export) {
+    if (export->song == NULL || !atomic_load(&export->is_finished)) return;
+    if (atomic_load(&export->is_worker_running)) pthread_join(export->worker, NULL);
+    atomic_store(&export->is_worker_running, false);
+    stems_release(export);
+}
+
+// Cancels an unfinished export and waits for the worker.
+void stems_stop(StemsExport *export) {
+    if (export->song == NULL) return;
+    if (atomic_exchange(&export->is_worker_running, false)) pthread_join(export->worker, NULL);
+    stems_release(export);
+}
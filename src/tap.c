@@ -0,0 +1,94 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Audio tap hands the rendered signal from the audio thread to the render
+// thread. The audio thread writes one block per engine block into a single
+// producer single consumer ring and never waits: if the ring is full the
+// block is dropped. The render thread drains the ring into a history that
+// is indexed by playback frame, so visuals can read the samples around the
+// frame that is audible right now.
+
+#define TAP_MAX_TRACKS 8
+#define TAP_CHANNEL_MIX 0
+#define TAP_CHANNELS (1 + TAP_MAX_TRACKS) // mix, then tracks
+#define TAP_CAPACITY 64                   // blocks, power of two
+#define TAP_HISTORY_FRAMES 8192           // power of two
+
+typedef struct {
+    uint64_t frame; // playback frame of the first sample
+    uint32_t count;
+    uint32_t track_count;
+    float channels[TAP_CHANNELS][ENGINE_BLOCK_SIZE];
+} TapBlock;
+
+typedef struct {
+    TapBlock blocks[TAP_CAPACITY];
+    _Atomic(uint64_t) write_index;
+    _Atomic(uint64_t) read_index;
+    _Atomic(uint64_t) dropped_blocks;
+} AudioTap;
+
+typedef struct {
+    float channels[TAP_CHANNELS][TAP_HISTORY_FRAMES];
+    uint64_t end_frame; // one past the newest sample
+    size_t track_count;
+} TapHistory;
+
+// Producer. Returns block to fill or NULL if the consumer fell behind.
+TapBlock *tap_reserve(AudioTap *tap) {
+    uint64_t write = atomic_load_explicit(&tap->write_index, memory_order_relaxed);
+    uint64_t read = atomic_load_explicit(&tap->read_index, memory_order_acquire);
+    if (write - read == TAP_CAPACITY) {
+        atomic_fetch_add_explicit(&tap->dropped_blocks, 1, memory_order_relaxed);
+        return NULL;
+    }
+    return &tap->blocks[write % TAP_CAPACITY];
+}
+
+void tap_commit(AudioTap *tap) {
+    uint64_t write = atomic_load_explicit(&tap->write_index, memory_order_relaxed);
+    atomic_store_explicit(&tap->write_index, write + 1, memory_order_release);
+}
+
+static void tap_history_write(TapHistory *history, const TapBlock *block) {
+    // playback was restarted or seeked back
+    if (block->frame < history->end_frame) {
+        memset(history->channels, 0, sizeof(history->channels));
+    }
+
+    size_t channels = 1 + block->track_count;
+    for (size_t i = 0; i < block->count; i++) {
+        size_t index = (block->frame + i) % TAP_HISTORY_FRAMES;
+        for (size_t c = 0; c < channels; c++) {
+            history->channels[c][index] = block->channels[c][i];
+        }
+    }
+
+    history->end_frame = block->frame + block->count;
+    history->track_count = block->track_count;
+}
+
+// Consumer, moves all published blocks into the history.
+void tap_drain(AudioTap *tap, TapHistory *history) {
+    uint64_t read = atomic_load_explicit(&tap->read_index, memory_order_relaxed);
+    uint64_t write = atomic_load_explicit(&tap->write_index, memory_order_acquire);
+
+    for (; read < write; read++) {
+        tap_history_write(history, &tap->blocks[read % TAP_CAPACITY]);
+    }
+    atomic_store_explicit(&tap->read_index, read, memory_order_release);
+}
+
+// Copies count samples of the channel that end at end_frame, samples that
+// are not in the history are silent.
+void tap_history_read(const TapHistory *history, size_t channel, uint64_t end_frame, float *out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint64_t frame = end_frame - count + i;
+        bool is_stored = end_frame + i >= count
+            && frame < history->end_frame
+            && history->end_frame - frame <= TAP_HISTORY_FRAMES;
+        out[i] = is_stored ? history->channels[channel][frame % TAP_HISTORY_FRAMES] : 0;
+    }
+}
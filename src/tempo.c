@@ -0,0 +1,134 @@
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Tempo map turns step indices into frames. It is a table of cumulative
+// step boundaries, boundaries[i] is the first frame of step i and
+// boundaries[settings_count] is the length of the song in frames.
+// Playback walks the table forward, random lookups use binary search.
+
+#define TEMPO_DEFAULT_BPM 75
+#define TEMPO_STEPS_PER_BEAT 4
+#define TEMPO_MIN_BPM 1
+#define TEMPO_MAX_BPM 1000
+
+typedef enum {
+    TEMPO_SET,   // tempo changes at the step
+    TEMPO_RAMP,  // tempo ramps linearly from the previous event, reaching value at the step
+    TEMPO_SWING, // even steps get longer by value, odd steps shorter by the same amount
+} TempoEventKind;
+
+typedef struct {
+    uint32_t step;
+    uint32_t kind;
+    float value;
+} TempoEvent;
+
+typedef struct {
+    uint64_t *boundaries;
+    size_t settings_count;
+    size_t sample_rate;
+} TempoMap;
+
+static int tempo_event_compare(const void *a, const void *b) {
+    const TempoEvent *x = a, *y = b;
+    if (x->step != y->step) return x->step < y->step ? -1 : 1;
+    if (x->kind != y->kind) return x->kind < y->kind ? -1 : 1;
+    return 0;
+}
+
+// Value is in range for the kind of the event.
+bool tempo_event_is_valid(const TempoEvent *event) {
+    switch (event->kind) {
+    case TEMPO_SET:
+    case TEMPO_RAMP:  return isfinite(event->value) && event->value >= TEMPO_MIN_BPM && event->value <= TEMPO_MAX_BPM;
+    case TEMPO_SWING: return event->value >= 0 && event->value < 1;
+    }
+    return false;
+}
+
+// Events at the same step are applied in kind order.
+void tempo_sort_events(TempoEvent *events, size_t count) {
+    qsort(events, count, sizeof(TempoEvent), tempo_event_compare);
+}
+
+// Events must be sorted by step.
+void tempo_map_build(TempoMap *map, const TempoEvent *events, size_t event_count,
+                     size_t settings_count, size_t sample_rate) {
+    map->settings_count = settings_count;
+    map->sample_rate = sample_rate;
+    map->boundaries = malloc((settings_count + 1) * sizeof(uint64_t));
+    assert(map->boundaries != NULL && "Buy MORE RAM lol!!");
+
+    double anchor_bpm = TEMPO_DEFAULT_BPM;
+    size_t anchor_step = 0;
+    double swing = 0;
+    double seconds = 0;
+
+    size_t applied = 0;      // events up to and including current step
+    size_t next_tempo = 0;   // first SET or RAMP event after current step
+
+    for (size_t i = 0; i < settings_count; i++) {
+        map->boundaries[i] = (uint64_t)llround(seconds * sample_rate);
+
+        for (; applied < event_count && events[applied].step <= i; applied++) {
+            const TempoEvent *event = &events[applied];
+            switch (event->kind) {
+            case TEMPO_SET:
+            case TEMPO_RAMP:
+                anchor_bpm = event->value;
+                anchor_step = i;
+                break;
+            case TEMPO_SWING:
+                swing = event->value;
+                break;
+            }
+        }
+
+        if (next_tempo < applied) next_tempo = applied;
+        while (next_tempo < event_count && events[next_tempo].kind == TEMPO_SWING) next_tempo++;
+
+        double bpm = anchor_bpm;
+        if (next_tempo < event_count && events[next_tempo].kind == TEMPO_RAMP) {
+            const TempoEvent *ramp = &events[next_tempo];
+            double t = (double)(i - anchor_step) / (double)(ramp->step - anchor_step);
+            bpm = anchor_bpm + (ramp->value - anchor_bpm) * t;
+        }
+
+        double step_seconds = 60.0 / (bpm * TEMPO_STEPS_PER_BEAT);
+        step_seconds *= (i % 2 == 0) ? 1.0 + swing : 1.0 - swing;
+        seconds += step_seconds;
+    }
+
+    map->boundaries[settings_count] = (uint64_t)llround(seconds * sample_rate);
+}
+
+void tempo_map_free(TempoMap *map) {
+    free(map->boundaries);
+    map->boundaries = NULL;
+}
+
+static inline uint64_t tempo_song_frames(const TempoMap *map) {
+    return map->boundaries[map->settings_count];
+}
+
+// Every step is at least a frame long, otherwise steps have no frames to play.
+bool tempo_map_is_valid(const TempoMap *map) {
+    for (size_t i = 0; i < map->settings_count; i++) {
+        if (map->boundaries[i + 1] <= map->boundaries[i]) return false;
+    }
+    return true;
+}
+
+// Returns step that contains the frame, frame must be inside of the song.
+size_t tempo_find_step(const TempoMap *map, uint64_t frame) {
+    size_t low = 0, high = map->settings_count;
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+        if (map->boundaries[middle] <= frame) low = middle;
+        else high = middle;
+    }
+    return low;
+}
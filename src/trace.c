@@ -0,0 +1,146 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// Timeline tracing. Every thread that records zones owns a ring, a zone is
+// pushed when it ends, so the producer only touches its own write index and
+// never waits. The render thread drains all rings into a Chrome trace JSON
+// file once per frame, the file opens in chrome://tracing and in Perfetto.
+// Full rings drop events and count them.
+//
+// Zone names point into the plugin, rings are drained before it unloads.
+
+#define TRACE_CAPACITY (1 << 14) // events per thread
+
+typedef enum {
+    TRACE_THREAD_RENDER,
+    TRACE_THREAD_AUDIO,
+    TRACE_THREAD_COUNT,
+} TraceThread;
+
+static const char *trace_thread_names[TRACE_THREAD_COUNT] = { "render", "audio" };
+
+typedef struct {
+    const char *name;
+    uint64_t begin; // nanoseconds
+    uint64_t end;
+    double value;
+    bool is_counter;
+} TraceEvent;
+
+typedef struct {
+    TraceEvent events[TRACE_CAPACITY];
+    _Atomic(size_t) write;
+    _Atomic(size_t) read;
+    _Atomic(size_t) dropped;
+} TraceRing;
+
+typedef struct {
+    TraceRing rings[TRACE_THREAD_COUNT];
+    _Atomic(bool) is_enabled;
+    FILE *file;
+    bool has_events;  // a comma goes before the next one
+    uint64_t origin;  // start of the trace
+} Trace;
+
+uint64_t trace_now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+// Start of a zone, 0 while tracing is off.
+uint64_t trace_begin(Trace *trace) {
+    if (!atomic_load_explicit(&trace->is_enabled, memory_order_relaxed)) return 0;
+    return trace_now();
+}
+
+static void trace_push(Trace *trace, TraceThread thread, TraceEvent event) {
+    TraceRing *ring = &trace->rings[thread];
+    size_t write = atomic_load_explicit(&ring->write, memory_order_relaxed);
+    size_t read = atomic_load_explicit(&ring->read, memory_order_acquire);
+    if (write - read >= TRACE_CAPACITY) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    ring->events[write % TRACE_CAPACITY] = event;
+    atomic_store_explicit(&ring->write, write + 1, memory_order_release);
+}
+
+// Records a zone from begin to now, name must be a string literal.
+void trace_end(Trace *trace, TraceThread thread, const char *name, uint64_t begin) {
+    if (begin == 0) return;
+    trace_push(trace, thread, (TraceEvent) { .name = name, .begin = begin, .end = trace_now() });
+}
+
+void trace_counter(Trace *trace, TraceThread thread, const char *name, double value) {
+    if (!atomic_load_explicit(&trace->is_enabled, memory_order_relaxed)) return;
+    trace_push(trace, thread, (TraceEvent) { .name = name, .begin = trace_now(), .value = value, .is_counter = true });
+}
+
+// Writes the events of all rings into the file, render thread only.
+void trace_flush(Trace *trace) {
+    if (trace->file == NULL) return;
+
+    for (size_t t = 0; t < TRACE_THREAD_COUNT; t++) {
+        TraceRing *ring = &trace->rings[t];
+        size_t read = atomic_load_explicit(&ring->read, memory_order_relaxed);
+        size_t write = atomic_load_explicit(&ring->write, memory_order_acquire);
+
+        for (; read != write; read++) {
+            const TraceEvent *event = &ring->events[read % TRACE_CAPACITY];
+            if (event->begin < trace->origin) continue; // left over from an earlier trace
+
+            double timestamp = (event->begin - trace->origin) / 1000.0;
+            if (trace->has_events) fputs(",\n", trace->file);
+            if (event->is_counter) {
+                fprintf(trace->file, "{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"tid\":%zu,\"args\":{\"value\":%g}}",
+                        event->name, timestamp, t, event->value);
+            } else {
+                fprintf(trace->file, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%zu}",
+                        event->name, timestamp, (event->end - event->begin) / 1000.0, t);
+            }
+            trace->has_events = true;
+        }
+        atomic_store_explicit(&ring->read, read, memory_order_release);
+    }
+}
+
+void trace_start(Trace *trace, const char *path) {
+    if (trace->file != NULL) return;
+
+    trace->file = fopen(path, "w");
+    if (trace->file == NULL) {
+        printf("trace.c: trace_start: Error: could not open %s\n", path);
+        return;
+    }
+
+    fputs("{\"traceEvents\":[\n", trace->file);
+    for (size_t t = 0; t < TRACE_THREAD_COUNT; t++) {
+        if (t > 0) fputs(",\n", trace->file);
+        fprintf(trace->file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"%s\"}}",
+                t, trace_thread_names[t]);
+        atomic_store(&trace->rings[t].dropped, 0);
+    }
+    trace->has_events = true;
+    trace->origin = trace_now();
+    atomic_store(&trace->is_enabled, true);
+    printf("Tracing into %s\n", path);
+}
+
+void trace_stop(Trace *trace) {
+    if (trace->file == NULL) return;
+
+    atomic_store(&trace->is_enabled, false);
+    trace_flush(trace);
+    fputs("\n]}\n", trace->file);
+    fclose(trace->file);
+    trace->file = NULL;
+
+    size_t dropped = 0;
+    for (size_t t = 0; t < TRACE_THREAD_COUNT; t++) dropped += atomic_load(&trace->rings[t].dropped);
+    if (dropped > 0) printf("trace.c: trace_stop: Error: %zu events did not fit into the rings\n", dropped);
+    printf("Tracing stopped\n");
+}
@@ -0,0 +1,179 @@
+#include <math.h>
+#include <stdbool.h>
+
+#include "raylib.h"
+#include "rlgl.h"
+
+// The visuals are three layers: a translucent background tint, a ring sector
+// and a circle in the middle. DrawFrame describes them in a Scene, which is
+// drawn either analytically by one full screen fragment shader pass, or with
+// the raylib shape functions as a reference.
+
+typedef struct {
+    Color background;
+
+    bool has_ring;
+    Vector2 ring_center;
+    float ring_inner_radius;
+    float ring_outer_radius;
+    float ring_start_angle; // degrees
+    float ring_end_angle;
+    Color ring_color;
+
+    Vector2 circle_center;
+    float circle_radius;
+    Color circle_color;
+} Scene;
+
+typedef enum {
+    SCENE_BACKGROUND,
+    SCENE_RING,          // inner radius, outer radius, start angle, end angle (radians)
+    SCENE_RING_COLOR,
+    SCENE_RING_CENTER,   // x, y, circle x, circle y
+    SCENE_CIRCLE,        // radius, render target height, render target scale, pixel size
+    SCENE_CIRCLE_COLOR,
+    SCENE_UNIFORM_COUNT,
+} SceneUniform;
+
+typedef struct {
+    Shader shader;
+    int scene_location;
+} SceneShader;
+
+// Colors are composited the way alpha blending over a black clear would,
+// including the destination alpha, so the shader output matches the reference.
+// Edges are antialiased analytically, shapes cover a pixel by their distance
+// to its center.
+static const char *scene_fragment_shader =
+    "#version 330\n"
+    "out vec4 finalColor;\n"
+    "uniform vec4 scene[6];\n"
+    "\n"
+    "const float TAU = 6.28318530718;\n"
+    "\n"
+    "vec4 over(vec4 destination, vec4 source) {\n"
+    "    return vec4(source.rgb * source.a + destination.rgb * (1.0 - source.a),\n"
+    "                source.a * source.a + destination.a * (1.0 - source.a));\n"
+    "}\n"
+    "\n"
+    "// distance is positive inside of the shape\n"
+    "float coverage(float distance, float pixel) {\n"
+    "    return clamp(distance / pixel + 0.5, 0.0, 1.0);\n"
+    "}\n"
+    "\n"
+    "void main() {\n"
+    "    vec4 background = scene[0], ring = scene[1], ringColor = scene[2];\n"
+    "    vec4 centers = scene[3], circle = scene[4], circleColor = scene[5];\n"
+    "    float pixel = circle.w;\n"
+    "\n"
+    "    // raylib coordinates, y goes down\n"
+    "    vec2 position = vec2(gl_FragCoord.x, circle.y - gl_FragCoord.y) / circle.z;\n"
+    "    vec4 color = over(vec4(0.0, 0.0, 0.0, 1.0), background);\n"
+    "\n"
+    "    vec2 fromRing = position - centers.xy;\n"
+    "    float radius = length(fromRing);\n"
+    "    float span = ring.w - ring.z;\n"
+    "    float sweep = mod(atan(fromRing.y, fromRing.x) - ring.z, TAU);\n"
+    "    float angular = sweep <= span ? min(sweep, span - sweep) : -min(sweep - span, TAU - sweep);\n"
+    "    float ringCoverage = coverage(min(radius - ring.x, ring.y - radius), pixel) * coverage(angular * radius, pixel);\n"
+    "    color = over(color, vec4(ringColor.rgb, ringColor.a * ringCoverage));\n"
+    "\n"
+    "    float circleCoverage = coverage(circle.x - length(position - centers.zw), pixel);\n"
+    "    color = over(color, vec4(circleColor.rgb, circleColor.a * circleCoverage));\n"
+    "\n"
+    "    finalColor = color;\n"
+    "}\n";
+
+SceneShader scene_shader_load(void) {
+    SceneShader result = {0};
+    result.shader = LoadShaderFromMemory(NULL, scene_fragment_shader);
+    result.scene_location = GetShaderLocation(result.shader, "scene");
+    return result;
+}
+
+void scene_shader_unload(SceneShader *scene_shader) {
+    UnloadShader(scene_shader->shader);
+    *scene_shader = (SceneShader) {0};
+}
+
+static void set_color(float *uniform, Color color) {
+    uniform[0] = color.r / 255.0f;
+    uniform[1] = color.g / 255.0f;
+    uniform[2] = color.b / 255.0f;
+    uniform[3] = color.a / 255.0f;
+}
+
+// Width and height are in scene coordinates, the target is scale times larger.
+void draw_scene_shader(const SceneShader *scene_shader, RenderBatch *batch, const Scene *scene, int width, int height, float scale) {
+    float uniforms[SCENE_UNIFORM_COUNT][4] = {0};
+
+    set_color(uniforms[SCENE_BACKGROUND], scene->background);
+
+    if (scene->has_ring) {
+        float start = scene->ring_start_angle, end = scene->ring_end_angle;
+        if (end < start) { float swap = start; start = end; end = swap; }
+
+        float inner = fminf(scene->ring_inner_radius, scene->ring_outer_radius);
+        float outer = fmaxf(scene->ring_inner_radius, scene->ring_outer_radius);
+        uniforms[SCENE_RING][0] = inner;
+        uniforms[SCENE_RING][1] = outer;
+        uniforms[SCENE_RING][2] = fmodf(start * DEG2RAD, 2 * PI);
+        uniforms[SCENE_RING][3] = uniforms[SCENE_RING][2] + (end - start) * DEG2RAD;
+        set_color(uniforms[SCENE_RING_COLOR], scene->ring_color);
+    } else {
+        // empty ring, its color stays transparent
+        uniforms[SCENE_RING][0] = 1;
+        uniforms[SCENE_RING][1] = 0;
+    }
+
+    uniforms[SCENE_RING_CENTER][0] = scene->ring_center.x;
+    uniforms[SCENE_RING_CENTER][1] = scene->ring_center.y;
+    uniforms[SCENE_RING_CENTER][2] = scene->circle_center.x;
+    uniforms[SCENE_RING_CENTER][3] = scene->circle_center.y;
+    uniforms[SCENE_CIRCLE][0] = scene->circle_radius;
+    uniforms[SCENE_CIRCLE][1] = height * scale;
+    uniforms[SCENE_CIRCLE][2] = scale;
+    uniforms[SCENE_CIRCLE][3] = 1 / scale;
+    set_color(uniforms[SCENE_CIRCLE_COLOR], scene->circle_color);
+
+    SetShaderValueV(scene_shader->shader, scene_shader->scene_location, uniforms, SHADER_UNIFORM_VEC4, SCENE_UNIFORM_COUNT);
+
+    // the shader computes final pixels, write them as they are
+    rlSetBlendFactors(RL_ONE, RL_ZERO, RL_FUNC_ADD);
+    BeginBlendMode(BLEND_CUSTOM);
+    BeginShaderMode(scene_shader->shader);
+    DrawRectangle(0, 0, width, height, WHITE);
+    render_batch_flush(batch);
+    EndShaderMode();
+    EndBlendMode();
+}
+
+void draw_scene_immediate(const Scene *scene, int width, int height) {
+    DrawRectangle(0, 0, width, height, scene->background);
+
+    if (scene->has_ring) {
+        DrawRing(
+            scene->ring_center,
+            scene->ring_inner_radius,
+            scene->ring_outer_radius,
+            scene->ring_start_angle,
+            scene->ring_end_angle,
+            50,
+            scene->ring_color
+        );
+    }
+
+    DrawCircle(scene->circle_center.x, scene->circle_center.y, scene->circle_radius, scene->circle_color);
+}
+
+// Bars around the circle, one per band, going clockwise from the top.
+void draw_spectrum_ring(const float *bands, size_t count, Vector2 center, float radius, float length, Color color) {
+    for (size_t b = 0; b < count; b++) {
+        float angle = 2 * PI * b / count - PI / 2;
+        Vector2 direction = { cosf(angle), sinf(angle) };
+        Vector2 start = { center.x + direction.x * radius, center.y + direction.y * radius };
+        float end_radius = radius + length * bands[b];
+        Vector2 end = { center.x + direction.x * end_radius, center.y + direction.y * end_radius };
+        DrawLineEx(start, end, 4, color);
+    }
+}
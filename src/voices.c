@@ -0,0 +1,171 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// A voice is a small graph of nodes that turns the three step parameters of
+// a track into a signal. Nodes are stored in the song file in execution
+// order, every node only reads nodes before it.
+
+#define GRAPH_MAX_NODES 16
+
+typedef enum {
+    NODE_PARAM,      // step parameter input1 (0..2 for wave1..wave3)
+    NODE_OSCILLATOR, // wave of shape, frequency from node input1
+    NODE_MODULATOR,  // node input1 * scale + offset
+    NODE_MULTIPLY,   // node input1 * node input2
+} NodeKind;
+
+typedef enum {
+    WAVE_SINE,
+    WAVE_TRIANGLE,
+    WAVE_SQUARE,
+} WaveShape;
+
+typedef struct {
+    uint8_t kind;
+    uint8_t shape;
+    uint8_t input1;
+    uint8_t input2;
+    float scale;
+    float offset;
+} Node;
+
+typedef enum {
+    VOICE_BASS,
+    VOICE_BEEPS,
+    VOICE_BEAT,
+    VOICE_COUNT,
+} VoiceKind;
+
+typedef struct {
+    const char *name;
+    bool reset_on_loop;
+    size_t node_count;
+    size_t output;
+    Node nodes[GRAPH_MAX_NODES];
+} VoicePreset;
+
+#define PARAM(wave)             { .kind = NODE_PARAM, .input1 = (wave) }
+#define OSCILLATOR(wave, freq)  { .kind = NODE_OSCILLATOR, .shape = (wave), .input1 = (freq) }
+#define UNIPOLAR(in)            { .kind = NODE_MODULATOR, .input1 = (in), .scale = 0.5f, .offset = 0.5f }
+#define MULTIPLY(a, b)          { .kind = NODE_MULTIPLY, .input1 = (a), .input2 = (b) }
+
+// Presets are written in reading order and sorted when a song is compiled.
+static const VoicePreset voice_presets[VOICE_COUNT] = {
+    [VOICE_BASS] = {
+        // sine with tremolo, pitch wobbled by a third sine
+        .name = "bass", .reset_on_loop = true, .node_count = 10, .output = 0,
+        .nodes = {
+            /* 0 */ MULTIPLY(1, 2),
+            /* 1 */ OSCILLATOR(WAVE_SINE, 3),
+            /* 2 */ UNIPOLAR(4),
+            /* 3 */ MULTIPLY(5, 6),
+            /* 4 */ OSCILLATOR(WAVE_SINE, 7),
+            /* 5 */ PARAM(0),
+            /* 6 */ UNIPOLAR(8),
+            /* 7 */ PARAM(1),
+            /* 8 */ OSCILLATOR(WAVE_SINE, 9),
+            /* 9 */ PARAM(2),
+        },
+    },
+    [VOICE_BEEPS] = {
+        // sine gated by two square waves
+        .name = "beeps", .reset_on_loop = true, .node_count = 10, .output = 0,
+        .nodes = {
+            /* 0 */ MULTIPLY(1, 2),
+            /* 1 */ MULTIPLY(3, 4),
+            /* 2 */ UNIPOLAR(5),
+            /* 3 */ OSCILLATOR(WAVE_SINE, 6),
+            /* 4 */ UNIPOLAR(7),
+            /* 5 */ OSCILLATOR(WAVE_SQUARE, 8),
+            /* 6 */ PARAM(0),
+            /* 7 */ OSCILLATOR(WAVE_SQUARE, 9),
+            /* 8 */ PARAM(2),
+            /* 9 */ PARAM(1),
+        },
+    },
+    [VOICE_BEAT] = {
+        // triangle with tremolo
+        .name = "beat", .reset_on_loop = false, .node_count = 6, .output = 0,
+        .nodes = {
+            /* 0 */ MULTIPLY(1, 2),
+            /* 1 */ OSCILLATOR(WAVE_TRIANGLE, 3),
+            /* 2 */ UNIPOLAR(4),
+            /* 3 */ PARAM(0),
+            /* 4 */ OSCILLATOR(WAVE_SINE, 5),
+            /* 5 */ PARAM(1),
+        },
+    },
+};
+
+static size_t node_input_count(const Node *node) {
+    switch (node->kind) {
+    case NODE_PARAM:      return 0;
+    case NODE_OSCILLATOR: return 1;
+    case NODE_MODULATOR:  return 1;
+    case NODE_MULTIPLY:   return 2;
+    }
+    return 0;
+}
+
+// Orders nodes so that every node comes after its inputs and remaps the
+// inputs. Returns false if the graph has a cycle or a dangling input.
+bool voice_sort(const Node *nodes, size_t node_count, size_t output,
+                Node *sorted, size_t *sorted_output) {
+    size_t order[GRAPH_MAX_NODES];
+    size_t position[GRAPH_MAX_NODES];
+    size_t dependencies[GRAPH_MAX_NODES] = {0};
+    size_t count = 0;
+
+    if (node_count == 0 || node_count > GRAPH_MAX_NODES || output >= node_count) return false;
+
+    for (size_t n = 0; n < node_count; n++) {
+        const Node *node = &nodes[n];
+        if (node->kind == NODE_PARAM && node->input1 > 2) return false;
+        if (node->kind != NODE_PARAM) {
+            if (node->input1 >= node_count) return false;
+            if (node_input_count(node) == 2 && node->input2 >= node_count) return false;
+        }
+        dependencies[n] = node_input_count(node);
+    }
+
+    // Kahn's algorithm, a node is ready when all of its inputs are placed
+    while (count < node_count) {
+        bool progress = false;
+        for (size_t n = 0; n < node_count; n++) {
+            if (dependencies[n] != 0) continue;
+            dependencies[n] = SIZE_MAX;
+            position[n] = count;
+            order[count++] = n;
+            progress = true;
+
+            for (size_t m = 0; m < node_count; m++) {
+                if (dependencies[m] == 0 || dependencies[m] == SIZE_MAX) continue;
+                size_t inputs = node_input_count(&nodes[m]);
+                if (inputs >= 1 && nodes[m].input1 == n) dependencies[m]--;
+                if (inputs >= 2 && nodes[m].input2 == n) dependencies[m]--;
+            }
+        }
+        if (!progress) return false;
+    }
+
+    for (size_t i = 0; i < node_count; i++) {
+        Node node = nodes[order[i]];
+        size_t inputs = node_input_count(&node);
+        if (inputs >= 1) node.input1 = position[node.input1];
+        if (inputs >= 2) node.input2 = position[node.input2];
+        sorted[i] = node;
+    }
+    *sorted_output = position[output];
+    return true;
+}
+
+const VoicePreset *voice_find(const char *name, VoiceKind *kind) {
+    for (size_t v = 0; v < VOICE_COUNT; v++) {
+        if (strcmp(voice_presets[v].name, name) == 0) {
+            *kind = v;
+            return &voice_presets[v];
+        }
+    }
+    return NULL;
+}
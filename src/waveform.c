@@ -0,0 +1,272 @@
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "raylib.h"
+#include "simd.h"
+
+// Waveform overview of the whole song. A worker renders the song offline
+// with its own engine state and reduces the samples into a pyramid of
+// min/max levels: level 0 holds one pair per OVERVIEW_BASE_FRAMES frames and
+// every next level halves the previous one. Drawing picks the level that
+// has about one pair per pixel, so any zoom touches O(pixels) pairs.
+//
+// The pyramid is filled front to back and can be drawn while it is built.
+// Songs longer than OVERVIEW_MAX_SECONDS are not rendered, their overview
+// has no levels.
+
+#define OVERVIEW_BASE_FRAMES 32
+#define OVERVIEW_MAX_LEVELS 40
+#define OVERVIEW_CHUNK_FRAMES (OVERVIEW_BASE_FRAMES * 2048)
+#define OVERVIEW_MAX_SECONDS (10 * 60)
+
+#define SCOPE_WINDOW 1024
+#define SCOPE_SEARCH 1024
+
+typedef struct {
+    float *min;
+    float *max;
+    size_t count;
+    size_t built; // filled by the worker
+} OverviewLevel;
+
+typedef struct {
+    Song *song; // NULL if there is no overview, also set for songs that are too long
+    uint64_t song_frames;
+    OverviewLevel levels[OVERVIEW_MAX_LEVELS];
+    size_t level_count;
+
+    // published by the worker, pairs below it in level 0 and the pairs they
+    // cover in the levels above are final
+    _Atomic(size_t) built_pairs;
+    _Atomic(bool) is_complete;
+
+    _Atomic(bool) is_worker_running;
+    pthread_t worker;
+
+    // engine state of the offline render, kept so the worker can resume
+    TrackState tracks[SONG_MAX_TRACKS];
+    float buffer[OVERVIEW_CHUNK_FRAMES * NUMBER_OF_CHANNELS];
+} Overview;
+
+// Reduces interleaved frames of one pair, both channels at once.
+static void overview_reduce_frames(const float *samples, size_t frames, float *min, float *max) {
+    size_t count = frames * NUMBER_OF_CHANNELS;
+    size_t vector_count = count & ~(size_t)3;
+    f32x4 low = f32x4_splat(INFINITY), high = f32x4_splat(-INFINITY);
+
+    for (size_t i = 0; i < vector_count; i += 4) {
+        f32x4 value = f32x4_load(samples + i);
+        low = (f32x4)(((i32x4)low & (low < value)) | ((i32x4)value & ~(low < value)));
+        high = (f32x4)(((i32x4)high & (high > value)) | ((i32x4)value & ~(high > value)));
+    }
+
+    float result_min = fminf(fminf(low[0], low[1]), fminf(low[2], low[3]));
+    float result_max = fmaxf(fmaxf(high[0], high[1]), fmaxf(high[2], high[3]));
+    for (size_t i = vector_count; i < count; i++) {
+        result_min = fminf(result_min, samples[i]);
+        result_max = fmaxf(result_max, samples[i]);
+    }
+    *min = result_min;
+    *max = result_max;
+}
+
+// Fills pairs of the levels above 0 that are covered by finished pairs below.
+static void overview_build_levels(Overview *overview, bool is_last) {
+    for (size_t l = 1; l < overview->level_count; l++) {
+        OverviewLevel *below = &overview->levels[l - 1];
+        OverviewLevel *level = &overview->levels[l];
+        size_t ready = is_last ? level->count : below->built / 2;
+
+        for (size_t i = level->built; i < ready; i++) {
+            size_t a = 2 * i, b = 2 * i + 1 < below->count ? 2 * i + 1 : 2 * i;
+            level->min[i] = fminf(below->min[a], below->min[b]);
+            level->max[i] = fmaxf(below->max[a], below->max[b]);
+        }
+        level->built = ready;
+    }
+}
+
+static void *overview_worker(void *argument) {
+    Overview *overview = argument;
+    OverviewLevel *base = &overview->levels[0];
+
+    while (atomic_load(&overview->is_worker_running) && base->built < base->count) {
+        uint64_t frame = (uint64_t)base->built * OVERVIEW_BASE_FRAMES;
+        size_t frames = OVERVIEW_CHUNK_FRAMES;
+        if (frames > overview->song_frames - frame) frames = overview->song_frames - frame;
+
+        render_song(overview->song, overview->tracks, frame, overview->buffer, frames,
+                    STEP_READER_OVERVIEW, true, NULL, NULL, NULL);
+
+        for (size_t offset = 0; offset < frames; offset += OVERVIEW_BASE_FRAMES) {
+            size_t count = frames - offset < OVERVIEW_BASE_FRAMES ? frames - offset : OVERVIEW_BASE_FRAMES;
+            overview_reduce_frames(overview->buffer + offset * NUMBER_OF_CHANNELS, count,
+                                   &base->min[base->built], &base->max[base->built]);
+            base->built++;
+        }
+
+        bool is_last = base->built == base->count;
+        overview_build_levels(overview, is_last);
+        atomic_store(&overview->built_pairs, base->built);
+        if (is_last) atomic_store(&overview->is_complete, true);
+    }
+    return NULL;
+}
+
+void overview_start_worker(Overview *overview) {
+    if (overview->level_count == 0 || atomic_load(&overview->is_complete)) return;
+    if (atomic_load(&overview->is_worker_running)) return;
+
+    atomic_store(&overview->is_worker_running, true);
+    if (pthread_create(&overview->worker, NULL, overview_worker, overview) != 0) {
+        printf("waveform.c: overview_start_worker: Error: could not create thread\n");
+        atomic_store(&overview->is_worker_running, false);
+    }
+}
+
+// Must be called before the plugin is unloaded and before the song's step
+// cache worker is stopped, the worker runs plugin code and reads steps.
+void overview_stop_worker(Overview *overview) {
+    if (!atomic_load(&overview->is_worker_running)) return;
+    atomic_store(&overview->is_worker_running, false);
+    pthread_join(overview->worker, NULL);
+}
+
+void overview_free(Overview *overview) {
+    overview_stop_worker(overview);
+    free(overview->levels[0].min);
+    memset(overview->levels, 0, sizeof(overview->levels));
+    overview->level_count = 0;
+    overview->song = NULL;
+    atomic_store(&overview->built_pairs, 0);
+    atomic_store(&overview->is_complete, false);
+}
+
+// Starts building the overview of the song, replacing the previous one.
+void overview_start(Overview *overview, Song *song, size_t sample_rate) {
+    overview_free(overview);
+    if (song == NULL) return;
+
+    // kept even if it is not rendered, so it is not started again
+    overview->song = song;
+    uint64_t song_frames = tempo_song_frames(&song->tempo);
+    if (song_frames == 0 || song_frames > (uint64_t)OVERVIEW_MAX_SECONDS * sample_rate) return;
+
+    size_t total = 0, count = (song_frames + OVERVIEW_BASE_FRAMES - 1) / OVERVIEW_BASE_FRAMES;
+    size_t level_count = 0;
+    for (size_t c = count; level_count < OVERVIEW_MAX_LEVELS; c = (c + 1) / 2) {
+        overview->levels[level_count++].count = c;
+        total += c;
+        if (c == 1) break;
+    }
+
+    float *pairs = malloc(2 * total * sizeof(float));
+    assert(pairs != NULL && "Buy MORE RAM lol!!");
+    for (size_t l = 0; l < level_count; l++) {
+        overview->levels[l].min = pairs;
+        overview->levels[l].max = pairs + overview->levels[l].count;
+        pairs += 2 * overview->levels[l].count;
+    }
+
+    overview->song_frames = song_frames;
+    overview->level_count = level_count;
+    memset(overview->tracks, 0, sizeof(overview->tracks));
+    overview_start_worker(overview);
+}
+
+// Min and max of the frames in [first, last), false if none of them are built.
+bool overview_range(const Overview *overview, uint64_t first, uint64_t last, float *min, float *max) {
+    if (overview->level_count == 0 || last <= first) return false;
+
+    // level with about two pairs in the range
+    size_t span = (last - first) / OVERVIEW_BASE_FRAMES;
+    size_t l = 0;
+    while (l + 1 < overview->level_count && ((size_t)4 << l) <= span) l++;
+
+    const OverviewLevel *level = &overview->levels[l];
+    size_t built = atomic_load(&overview->is_complete) ? level->count : atomic_load(&overview->built_pairs) >> l;
+    size_t pair_frames = (size_t)OVERVIEW_BASE_FRAMES << l;
+    size_t from = first / pair_frames;
+    size_t to = (last - 1) / pair_frames + 1;
+    if (to > built) to = built;
+    if (from >= to) return false;
+
+    float result_min = level->min[from], result_max = level->max[from];
+    for (size_t i = from + 1; i < to; i++) {
+        result_min = fminf(result_min, level->min[i]);
+        result_max = fmaxf(result_max, level->max[i]);
+    }
+    *min = result_min;
+    *max = result_max;
+    return true;
+}
+
+// Draws frames in [first, last) of the song over the area, one column per pixel.
+void overview_draw(const Overview *overview, Rectangle area, uint64_t first, uint64_t last, uint64_t playhead, Color color) {
+    DrawRectangleRec(area, (Color) { 0, 0, 0, 120 });
+    if (overview->song != NULL && overview->level_count == 0) {
+        DrawText("song is too long for an overview", area.x + 10, area.y + area.height / 2 - 10, 20, color);
+        return;
+    }
+    if (overview->song == NULL || last <= first) return;
+
+    float middle = area.y + area.height / 2;
+    double frames_per_pixel = (double)(last - first) / area.width;
+    for (int x = 0; x < (int)area.width; x++) {
+        uint64_t from = first + (uint64_t)(x * frames_per_pixel);
+        uint64_t to = first + (uint64_t)((x + 1) * frames_per_pixel);
+        if (to <= from) to = from + 1;
+
+        float min, max;
+        if (!overview_range(overview, from, to, &min, &max)) continue;
+        float top = middle - fminf(max, 1) * area.height / 2;
+        float bottom = middle - fmaxf(min, -1) * area.height / 2;
+        DrawLineV((Vector2) { area.x + x + 0.5f, top }, (Vector2) { area.x + x + 0.5f, bottom + 1 }, color);
+    }
+
+    if (playhead >= first && playhead < last) {
+        float x = area.x + (float)((playhead - first) / frames_per_pixel);
+        DrawLineV((Vector2) { x, area.y }, (Vector2) { x, area.y + area.height }, RED);
+    }
+}
+
+// Scope of the mix that ends at the frame. The window starts at the latest
+// rising zero crossing that leaves room for it, so periodic signals stand
+// still, and runs free if there is none.
+void scope_draw(const TapHistory *history, uint64_t end_frame, Rectangle area, Color color) {
+    float samples[SCOPE_SEARCH + SCOPE_WINDOW];
+    tap_history_read(history, TAP_CHANNEL_MIX, end_frame, samples, SCOPE_SEARCH + SCOPE_WINDOW);
+
+    size_t start = SCOPE_SEARCH;
+    for (size_t i = SCOPE_SEARCH; i > 0; i--) {
+        if (samples[i - 1] < 0 && samples[i] >= 0) {
+            start = i;
+            break;
+        }
+    }
+
+    DrawRectangleRec(area, (Color) { 0, 0, 0, 120 });
+    float middle = area.y + area.height / 2;
+    float samples_per_pixel = (float)SCOPE_WINDOW / area.width;
+    for (int x = 0; x < (int)area.width; x++) {
+        size_t from = start + (size_t)(x * samples_per_pixel);
+        size_t to = start + (size_t)((x + 1) * samples_per_pixel);
+        if (to <= from) to = from + 1;
+
+        float min = samples[from], max = samples[from];
+        for (size_t i = from + 1; i < to; i++) {
+            min = fminf(min, samples[i]);
+            max = fmaxf(max, samples[i]);
+        }
+        float top = middle - fminf(max, 1) * area.height / 2;
+        float bottom = middle - fmaxf(min, -1) * area.height / 2;
+        DrawLineV((Vector2) { area.x + x + 0.5f, top }, (Vector2) { area.x + x + 0.5f, bottom + 1 }, color);
+    }
+}